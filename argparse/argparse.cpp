@@ -10,51 +10,235 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "argparse.hpp"
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 #ifdef NEXT_MPI
     #include <mpi.h>
 #endif
 
 namespace next {
 
-Arguments parse_arguments(int argc, char** argv, int rank)
-{
-    if (argc != 6) {
-        // Only rank 0 prints usage
-        if (rank == 0) {
-            std::cerr << "Usage: next <input.txt> <threads> <dt> <dump_interval> <vtk|vtu|hdf5>\n";
-        }
+namespace {
 
+// Only rank 0 prints, then every rank leaves
+[[noreturn]] void fail(int rank, const std::string& msg)
+{
+    if (rank == 0) {
+        std::cerr << msg;
+    }
 #ifdef NEXT_MPI
-        MPI_Finalize();
+    MPI_Finalize();
 #endif
-        std::exit(1);
+    std::exit(1);
+}
+
+constexpr const char* USAGE =
+    "Usage: next <input.txt> <threads> <dt> <dump_interval> <vtk|vtk-bin|vtu|vtu-bin|vtu-zlib|hdf5> [options]\n"
+    "Options:\n"
+    "  --theta <value>          Opening angle of the tree or FMM (default 0.5); the start value with --force-error\n"
+    "  --force-error <value>    Tune theta to this RMS relative force error against a direct sum, 0 = fixed theta (default 0)\n"
+    "  --tune-interval <n>      Re-tune theta every n steps (default 16)\n"
+    "  --tune-sample <n>        Targets per rank checked against direct summation (default 128)\n"
+    "  --solver <bh|fmm|direct> Gravity solver: Barnes-Hut, Fast Multipole Method or direct summation (default bh);\n"
+    "                           direct softens each pair by the particle masses only, without the tree's\n"
+    "                           node-size softening or the Dark Matter floor, so results differ from bh/fmm\n"
+    "  --direct-below <n>       Use direct summation while there are fewer than n particles, 0 = never (default 0);\n"
+    "                           softened like --solver direct\n"
+    "  --walk <particle|group>  Tree walk: per particle or per group of targets (default particle)\n"
+    "  --group-size <n>         Maximum targets per group for --walk group (default 16)\n"
+    "  --reorder <n>            Morton-sort particles every n steps, 0 = never (default 4); under MPI this sort\n"
+    "                           is the domain decomposition, so it also migrates particles between ranks\n"
+    "  --decompose <n>          Under MPI, decompose the domain at least every n steps, 0 = only with --reorder (default 16)\n"
+    "  --tree <rebuild|refit>   Rebuild the tree for every force pass, or refit it while it stays good (default rebuild)\n"
+    "  --timesteps <global|block> One adaptive dt, or per-particle block timesteps (default global)\n"
+    "  --eta <value>            Accuracy of the block-timestep criterion (default 0.025)\n"
+    "  --max-rung <n>           Finest block timestep is dt / 2^n, 0 to 30 (default 10)\n"
+    "  --io-buffers <n>         Snapshots that can wait for the background writer, 0 = write synchronously (default 2)\n"
+    "  --checkpoint-interval <n> Write a restart checkpoint every n steps and on exit, 0 = never (default 0)\n"
+    "  --checkpoint <name>      Checkpoint files are <name>.nck, <name>_rank<r>.nck under MPI (default checkpoint)\n"
+    "  --restart <name>         Resume from checkpoint <name> instead of loading the input file\n"
+    "  --map-interval <n>       Write projected density and velocity maps every n steps, 0 = never (default 0)\n"
+    "  --map-size <n>           Pixels per side of the maps (default 512)\n"
+    "  --map-axes <xyz>         Projection axes, e.g. z or xyz (default z)\n"
+    "  --map-extent <value>     Half-width of the map window around the origin, 0 = fit to the particles (default 0)\n"
+    "  --map-by-type <0|1>      One map per particle type instead of all particles together (default 0)\n"
+    "  --lod-depth <n>          Dumps hold tree nodes down to depth n as pseudo-particles, 0 = all particles (default 0)\n"
+    "  --lod-mass <value>       Dumps hold tree nodes of at most this mass as pseudo-particles, 0 = off (default 0)\n"
+    "  --lod-roi <x,y,z,h>      With --lod-depth/--lod-mass, keep all particles in the cube of half-width h around (x, y, z)\n";
+
+// Whole-string number parsing; anything else ends the run with a message instead of an exception
+int toInt(const std::string& text, const std::string& what, int rank)
+{
+    try {
+        size_t used = 0;
+        const int v = std::stoi(text, &used);
+        if (used == text.size()) return v;
+    } catch (const std::exception&) {
+    }
+    fail(rank, "Invalid integer '" + text + "' for " + what + "\n" + USAGE);
+}
+
+long long toLong(const std::string& text, const std::string& what, int rank)
+{
+    try {
+        size_t used = 0;
+        const long long v = std::stoll(text, &used);
+        if (used == text.size()) return v;
+    } catch (const std::exception&) {
+    }
+    fail(rank, "Invalid integer '" + text + "' for " + what + "\n" + USAGE);
+}
+
+double toDouble(const std::string& text, const std::string& what, int rank)
+{
+    try {
+        size_t used = 0;
+        const double v = std::stod(text, &used);
+        if (used == text.size()) return v;
+    } catch (const std::exception&) {
+    }
+    fail(rank, "Invalid number '" + text + "' for " + what + "\n" + USAGE);
+}
+
+} // namespace
+
+Arguments parse_arguments(int argc, char** argv, int rank)
+{
+    if (argc < 6) {
+        fail(rank, USAGE);
     }
 
     Arguments args;
 
     args.input_file    = argv[1];
-    args.threads       = std::stoi(argv[2]);
-    args.dt            = std::stod(argv[3]);
-    args.dump_interval = std::stod(argv[4]);
+    args.threads       = toInt(argv[2], "<threads>", rank);
+    args.dt            = toDouble(argv[3], "<dt>", rank);
+    args.dump_interval = toDouble(argv[4], "<dump_interval>", rank);
 
     std::string fmt = argv[5];
 
     if (fmt == "vtk") {
         args.format = OutputFormat::VTK;
+    } else if (fmt == "vtk-bin") {
+        args.format = OutputFormat::VTKBinary;
     } else if (fmt == "vtu") {
         args.format = OutputFormat::VTU;
+    } else if (fmt == "vtu-bin") {
+        args.format = OutputFormat::VTUBinary;
+    } else if (fmt == "vtu-zlib") {
+        args.format = OutputFormat::VTUZlib;
     } else if (fmt == "hdf5") {
         args.format = OutputFormat::HDF5;
     } else {
-        if (rank == 0) {
-            std::cerr << "Choose a file format: vtk, vtu, or hdf5\n";
+        fail(rank, "Choose a file format: vtk, vtk-bin, vtu, vtu-bin, vtu-zlib, or hdf5\n");
+    }
+
+    // Optional "--name value" pairs after the positional arguments
+    for (int k = 6; k < argc; k += 2) {
+        std::string key = argv[k];
+        if (k + 1 >= argc) {
+            fail(rank, "Missing value for " + key + "\n" + USAGE);
+        }
+        std::string value = argv[k + 1];
+
+        if (key == "--theta") {
+            args.gravity.theta = static_cast<real>(toDouble(value, key, rank));
+            if (!(args.gravity.theta > 0)) fail(rank, "--theta must be positive\n");
+        } else if (key == "--force-error") {
+            args.gravity.forceError = static_cast<real>(toDouble(value, key, rank));
+        } else if (key == "--tune-interval") {
+            args.gravity.thetaInterval = std::max(1, toInt(value, key, rank));
+        } else if (key == "--tune-sample") {
+            args.gravity.thetaSample = std::max(1, toInt(value, key, rank));
+        } else if (key == "--solver") {
+            if (value == "bh") {
+                args.gravity.solver = GravitySolver::BarnesHut;
+            } else if (value == "fmm") {
+                args.gravity.solver = GravitySolver::Fmm;
+            } else if (value == "direct") {
+                args.gravity.solver = GravitySolver::Direct;
+            } else {
+                fail(rank, "Choose a gravity solver: bh, fmm or direct\n");
+            }
+        } else if (key == "--direct-below") {
+            args.gravity.directBelow = toLong(value, key, rank);
+        } else if (key == "--walk") {
+            if (value == "particle") {
+                args.gravity.walk = TreeWalk::Particle;
+            } else if (value == "group") {
+                args.gravity.walk = TreeWalk::Group;
+            } else {
+                fail(rank, "Choose a tree walk: particle or group\n");
+            }
+        } else if (key == "--group-size") {
+            args.gravity.groupSize = toInt(value, key, rank);
+            if (args.gravity.groupSize <= 0) fail(rank, "--group-size must be positive\n");
+        } else if (key == "--reorder") {
+            args.gravity.reorderInterval = toInt(value, key, rank);
+            if (args.gravity.reorderInterval < 0) fail(rank, "--reorder must be 0 or positive\n");
+        } else if (key == "--decompose") {
+            args.gravity.decomposeInterval = std::max(0, toInt(value, key, rank));
+        } else if (key == "--tree") {
+            if (value == "rebuild") {
+                args.gravity.treeUpdate = TreeUpdate::Rebuild;
+            } else if (value == "refit") {
+                args.gravity.treeUpdate = TreeUpdate::Refit;
+            } else {
+                fail(rank, "Choose a tree update: rebuild or refit\n");
+            }
+        } else if (key == "--timesteps") {
+            if (value == "global") {
+                args.timesteps = TimestepMode::Global;
+            } else if (value == "block") {
+                args.timesteps = TimestepMode::Block;
+            } else {
+                fail(rank, "Choose a timestep mode: global or block\n");
+            }
+        } else if (key == "--eta") {
+            args.gravity.blockEta = static_cast<real>(toDouble(value, key, rank));
+            if (!(args.gravity.blockEta > 0)) fail(rank, "--eta must be positive\n");
+        } else if (key == "--max-rung") {
+            args.gravity.maxRung = toInt(value, key, rank);
+            if (args.gravity.maxRung < 0 || args.gravity.maxRung > 30) fail(rank, "--max-rung must be between 0 and 30\n");
+        } else if (key == "--io-buffers") {
+            args.io_buffers = std::max(0, toInt(value, key, rank));
+        } else if (key == "--checkpoint-interval") {
+            args.checkpoint_interval = std::max(0, toInt(value, key, rank));
+        } else if (key == "--checkpoint") {
+            args.checkpoint = value;
+        } else if (key == "--restart") {
+            args.restart = value;
+        } else if (key == "--map-interval") {
+            args.map_interval = std::max(0, toInt(value, key, rank));
+        } else if (key == "--map-size") {
+            args.map_size = std::max(1, toInt(value, key, rank));
+        } else if (key == "--map-axes") {
+            if (value.empty() || value.find_first_not_of("xyz") != std::string::npos) {
+                fail(rank, "Choose map axes out of x, y and z, e.g. z or xyz\n");
+            }
+            args.map_axes = value;
+        } else if (key == "--map-extent") {
+            args.map_extent = toDouble(value, key, rank);
+        } else if (key == "--map-by-type") {
+            args.map_by_type = toInt(value, key, rank) != 0;
+        } else if (key == "--lod-depth") {
+            args.lod_depth = std::max(0, toInt(value, key, rank));
+        } else if (key == "--lod-mass") {
+            args.lod_mass = toDouble(value, key, rank);
+        } else if (key == "--lod-roi") {
+            std::vector<std::string> parts(1);
+            for (char ch : value) {
+                if (ch == ',') parts.emplace_back();
+                else parts.back() += ch;
+            }
+            if (parts.size() != 4) fail(rank, "Give the region as x,y,z,halfwidth\n");
+            for (int c = 0; c < 4; ++c) args.lod_roi[c] = toDouble(parts[c], key, rank);
+        } else {
+            fail(rank, "Unknown option " + key + "\n" + USAGE);
         }
-#ifdef NEXT_MPI
-        MPI_Finalize();
-#endif
-        std::exit(1);
     }
 
     return args;
@@ -1,20 +1,43 @@
 #pragma once
 #include <string>
+#include "gravity/config.h"
 
 namespace next {
 
 enum class OutputFormat {
     VTK,
+    VTKBinary,      // Big-endian BINARY legacy VTK
     VTU,
+    VTUBinary,      // Raw binary appended data
+    VTUZlib,        // Appended data in zlib-compressed blocks
     HDF5
 };
 
+enum class TimestepMode {
+    Global,     // One adaptive dt for all particles
+    Block       // Hierarchical power-of-two block timesteps
+};
+
 struct Arguments {
     std::string input_file;
     int threads;
     double dt;
     double dump_interval;
     OutputFormat format;
+    GravityConfig gravity;
+    TimestepMode timesteps = TimestepMode::Global;
+    int io_buffers = 2;         // Snapshots staged for the background writer (0 = write synchronously)
+    std::string checkpoint = "checkpoint";  // Base name of the checkpoint files
+    int checkpoint_interval = 0;            // Steps between checkpoints (0 = never)
+    std::string restart;                    // Checkpoint to resume from instead of the input file
+    int map_interval = 0;                   // Steps between projected maps (0 = never)
+    int map_size = 512;                     // Pixels per side of the maps
+    std::string map_axes = "z";             // Projection axes, any of "xyz"
+    double map_extent = 0;                  // Half-width of the map window, 0 = fit to the particles
+    bool map_by_type = false;               // One map per particle type instead of all together
+    int lod_depth = 0;                      // Level-of-detail dumps: deepest tree level written, 0 = off
+    double lod_mass = 0;                    // ... or the largest node mass written as one pseudo-particle, 0 = off
+    double lod_roi[4] = { 0, 0, 0, -1 };    // Region kept at full resolution: center x, y, z and half-width
 };
 
 Arguments parse_arguments(int argc, char** argv, int rank);
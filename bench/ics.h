@@ -0,0 +1,189 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "struct/particle.h"
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <string>
+
+/**
+ * @brief Deterministic random numbers for the benchmark initial conditions.
+ * Only the raw engine output is used (the std:: distributions are implementation-defined),
+ * so a seed gives the same particles with every compiler and standard library.
+ */
+struct IcRandom {
+    std::mt19937_64 engine;
+
+    explicit IcRandom(uint64_t seed) : engine(seed) {}
+
+    double uniform() { return static_cast<double>(engine() >> 11) * (1.0 / 9007199254740992.0); }  // [0, 1)
+
+    double gauss() {
+        const double two_pi = 6.283185307179586;
+        double u = 1.0 - uniform();
+        return std::sqrt(-2.0 * std::log(u)) * std::cos(two_pi * uniform());
+    }
+
+    /** @brief Random point on the unit sphere. */
+    void direction(double& ux, double& uy, double& uz) {
+        const double two_pi = 6.283185307179586;
+        uz = 2.0 * uniform() - 1.0;
+        const double s = std::sqrt(1.0 - uz * uz), phi = two_pi * uniform();
+        ux = s * std::cos(phi);
+        uy = s * std::sin(phi);
+    }
+};
+
+/**
+ * @brief Radius drawn from a Plummer sphere of scale radius a (the far tail is cut at 10 a).
+ */
+inline double plummerRadius(IcRandom& rng, double a) {
+    while (true) {
+        const double u = rng.uniform();
+        if (u <= 0) continue;
+        const double r = a / std::sqrt(std::pow(u, -2.0 / 3.0) - 1.0);
+        if (r < 10.0 * a) return r;
+    }
+}
+
+/**
+ * @brief Plummer sphere in virial equilibrium (G = M = a = 1), velocities sampled with the
+ * rejection method of Aarseth, Henon & Wielen (1974). All particles are stars.
+ */
+inline Particle icPlummer(int N, IcRandom& rng) {
+    Particle p;
+    for (int i = 0; i < N; ++i) {
+        const double r = plummerRadius(rng, 1.0);
+        double ux, uy, uz;
+        rng.direction(ux, uy, uz);
+
+        // q = v / v_escape follows q^2 (1 - q^2)^3.5
+        double q, g;
+        do {
+            q = rng.uniform();
+            g = 0.1 * rng.uniform();
+        } while (g > q * q * std::pow(1.0 - q * q, 3.5));
+        const double v = q * std::sqrt(2.0) * std::pow(1.0 + r * r, -0.25);
+        double vx, vy, vz;
+        rng.direction(vx, vy, vz);
+
+        p.addParticle(real(r * ux), real(r * uy), real(r * uz),
+                      real(v * vx), real(v * vy), real(v * vz), real(1.0 / N), 0);
+    }
+    p.assignIds();
+    return p;
+}
+
+/**
+ * @brief Particles at rest, spread uniformly over the cube [-1, 1]^3.
+ */
+inline Particle icUniformCube(int N, IcRandom& rng) {
+    Particle p;
+    for (int i = 0; i < N; ++i) {
+        const double x = 2.0 * rng.uniform() - 1.0;
+        const double y = 2.0 * rng.uniform() - 1.0;
+        const double z = 2.0 * rng.uniform() - 1.0;
+        p.addParticle(real(x), real(y), real(z), 0, 0, 0, real(1.0 / N), 0);
+    }
+    p.assignIds();
+    return p;
+}
+
+/**
+ * @brief Cold collapse as in examples/ColdCollapseGalaxy (tools/icbuilder.py coldPlummer):
+ * a Plummer distribution at rest, half stars holding 10% of the mass, half Dark Matter.
+ */
+inline Particle icColdCollapse(int N, IcRandom& rng) {
+    Particle p;
+    const int nStars = N / 2;
+    for (int i = 0; i < N; ++i) {
+        const bool dm = i >= nStars;
+        const double m = dm ? 0.9 / (N - nStars) : 0.1 / nStars;
+        const double r = plummerRadius(rng, 1.0);
+        double ux, uy, uz;
+        rng.direction(ux, uy, uz);
+        p.addParticle(real(r * ux), real(r * uy), real(r * uz), 0, 0, 0, real(m), dm ? 1 : 0);
+    }
+    p.assignIds();
+    return p;
+}
+
+/**
+ * @brief One disk galaxy as in tools/icbuilder.py disk(): an exponential stellar disk on
+ * circular orbits inside a Hernquist Dark Matter halo. Scale lengths are in units of the disk
+ * scale; the galaxy is tilted by 'tilt' radians about the x axis, then moved to (ox, oy, oz)
+ * with bulk velocity (ovx, ovy, ovz).
+ */
+inline void addDiskGalaxy(Particle& p, int N, double massScale, double tilt,
+                          double ox, double oy, double oz, double ovx, double ovy, double ovz,
+                          IcRandom& rng) {
+    const double two_pi = 6.283185307179586;
+    const double mDisk = 1.0 * massScale, mHalo = 5.0 * massScale;
+    const double halo = 4.0, thickness = 0.05;
+    const int nDisk = N / 3, nHalo = N - nDisk;
+    const double ct = std::cos(tilt), st = std::sin(tilt);
+
+    auto add = [&](double x, double y, double z, double vx, double vy, double vz, double m, int type) {
+        p.addParticle(real(ox + x), real(oy + ct * y - st * z), real(oz + st * y + ct * z),
+                      real(ovx + vx), real(ovy + ct * vy - st * vz), real(ovz + st * vy + ct * vz),
+                      real(m), type);
+    };
+    auto haloMass = [&](double r) { return mHalo * (r * r) / ((r + halo) * (r + halo)); };
+
+    for (int i = 0; i < nDisk; ++i) {
+        const double r = -std::log(1.0 - 0.999 * rng.uniform());
+        const double phi = two_pi * rng.uniform();
+        const double enclosed = mDisk * (1.0 - std::exp(-r) * (1.0 + r)) + haloMass(r);
+        const double v = std::sqrt(enclosed / (r + 1e-6));
+        add(r * std::cos(phi), r * std::sin(phi), thickness * rng.gauss(),
+            -v * std::sin(phi), v * std::cos(phi), 0.05 * v * rng.gauss(), mDisk / nDisk, 0);
+    }
+
+    for (int i = 0; i < nHalo; ++i) {
+        const double s = std::sqrt(0.95 * rng.uniform());
+        const double r = halo * s / (1.0 - s);
+        double ux, uy, uz;
+        rng.direction(ux, uy, uz);
+        const double sigma = std::sqrt(haloMass(r) / (2.0 * (r + 1e-6)));
+        add(r * ux, r * uy, r * uz, sigma * rng.gauss(), sigma * rng.gauss(), sigma * rng.gauss(),
+            mHalo / nHalo, 1);
+    }
+}
+
+/**
+ * @brief Two disk galaxies on a collision course, like examples/TwoDifferentGalaxies:
+ * the second one is lighter and tilted by 45 degrees.
+ */
+inline Particle icMerger(int N, IcRandom& rng) {
+    Particle p;
+    const int n1 = N / 2 + N / 10;
+    addDiskGalaxy(p, n1,     1.0, 0.0,                -8.0, -1.0, 0.0,  0.25, 0.0, 0.0, rng);
+    addDiskGalaxy(p, N - n1, 0.8, 0.7853981633974483,  8.0,  1.0, 0.0, -0.25, 0.0, 0.0, rng);
+    p.assignIds();
+    return p;
+}
+
+/**
+ * @brief Builds the named initial conditions ("plummer", "cube", "collapse" or "merger") with
+ * N particles from 'seed'. Returns false for an unknown name.
+ */
+inline bool makeInitialConditions(const std::string& name, int N, uint64_t seed, Particle& out) {
+    IcRandom rng(seed);
+    if (name == "plummer")       out = icPlummer(N, rng);
+    else if (name == "cube")     out = icUniformCube(N, rng);
+    else if (name == "collapse") out = icColdCollapse(N, rng);
+    else if (name == "merger")   out = icMerger(N, rng);
+    else return false;
+    return true;
+}
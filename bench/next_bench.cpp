@@ -0,0 +1,372 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// next_bench: reproducible performance measurements of the NEXT building blocks.
+// Every configuration (initial conditions x N x threads) is generated in memory from a fixed
+// seed, and each phase is timed on its own. Results go out as CSV, one row per phase.
+
+#include "ics.h"
+#include "dt/adaptive.h"
+#include "floatdef.h"
+#include "gravity/kernels.h"
+#include "gravity/step.h"
+#include "io/hdf5_save.h"
+#include "io/vtk_save.h"
+#include "io/vtu_save.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <omp.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "hdf5.h"
+
+namespace {
+
+struct BenchOptions {
+    std::vector<std::string> ics = { "plummer", "cube", "collapse", "merger" };
+    std::vector<int> sizes = { 10000, 100000 };
+    std::vector<int> threads;          // Default: 1 and all available
+    int repeat = 5;
+    real theta = real(0.5);
+    uint64_t seed = 12345;
+    bool io = true;
+    std::string dir = ".";             // Where the writers put their (deleted) snapshots
+    std::string out;                   // CSV file; stdout if empty
+};
+
+void printUsage() {
+    std::cout <<
+        "Usage: next_bench [options]\n"
+        "Options:\n"
+        "  --ic <list>        Initial conditions: plummer,cube,collapse,merger (default all)\n"
+        "  --n <list>         Particle counts (default 10000,100000)\n"
+        "  --threads <list>   OpenMP thread counts (default 1 and the maximum)\n"
+        "  --repeat <k>       Timed repetitions per phase, after one warm-up (default 5)\n"
+        "  --theta <value>    Opening angle of the tree and FMM (default 0.5)\n"
+        "  --seed <s>         Seed of the initial conditions (default 12345)\n"
+        "  --no-io            Skip the snapshot writers\n"
+        "  --dir <path>       Directory for the temporary snapshots (default .)\n"
+        "  --out <file>       Write the CSV to a file instead of stdout\n";
+}
+
+std::vector<std::string> splitList(const std::string& s) {
+    std::vector<std::string> items;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+std::vector<int> splitInts(const std::string& s) {
+    std::vector<int> values;
+    for (const std::string& item : splitList(s)) values.push_back(std::atoi(item.c_str()));
+    return values;
+}
+
+bool parseOptions(int argc, char** argv, BenchOptions& opt) {
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--help" || a == "-h") { printUsage(); std::exit(0); }
+        else if (a == "--no-io") opt.io = false;
+        else if (a == "--ic" && hasValue) opt.ics = splitList(argv[++i]);
+        else if (a == "--n" && hasValue) opt.sizes = splitInts(argv[++i]);
+        else if (a == "--threads" && hasValue) opt.threads = splitInts(argv[++i]);
+        else if (a == "--repeat" && hasValue) opt.repeat = std::max(1, std::atoi(argv[++i]));
+        else if (a == "--theta" && hasValue) opt.theta = static_cast<real>(std::atof(argv[++i]));
+        else if (a == "--seed" && hasValue) opt.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (a == "--dir" && hasValue) opt.dir = argv[++i];
+        else if (a == "--out" && hasValue) opt.out = argv[++i];
+        else {
+            std::cerr << "next_bench: unknown or incomplete option '" << a << "'\n";
+            return false;
+        }
+    }
+
+    if (opt.threads.empty()) {
+        opt.threads.push_back(1);
+        if (omp_get_max_threads() > 1) opt.threads.push_back(omp_get_max_threads());
+    }
+    for (const std::string& name : opt.ics) {
+        if (name != "plummer" && name != "cube" && name != "collapse" && name != "merger") {
+            std::cerr << "next_bench: unknown initial conditions '" << name << "'\n";
+            return false;
+        }
+    }
+    for (int n : opt.sizes) {
+        if (n < 2) { std::cerr << "next_bench: particle counts must be at least 2\n"; return false; }
+    }
+    for (int t : opt.threads) {
+        if (t < 1) { std::cerr << "next_bench: thread counts must be at least 1\n"; return false; }
+    }
+    std::error_code ec;
+    if (opt.io && !std::filesystem::is_directory(opt.dir, ec)) {
+        std::cerr << "next_bench: --dir '" << opt.dir << "' is not a directory\n";
+        return false;
+    }
+    return true;
+}
+
+const char* precisionName() {
+#if defined(NEXT_MIXED)
+    return "mixed";
+#elif defined(NEXT_FP64)
+    return "FP64";
+#else
+    return "FP32";
+#endif
+}
+
+double msSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+/**
+ * @brief Writes one CSV row per phase: min, median and mean over the timed repetitions, and
+ * for the force phases the RMS relative force error (empty for the others).
+ */
+struct Report {
+    std::ostream& out;
+    std::string ic;
+    int n = 0, threads = 0;
+
+    static void header(std::ostream& out) {
+        out << "ic,n,threads,phase,repeats,min_ms,median_ms,mean_ms,rms_force_error\n";
+    }
+
+    void row(const std::string& phase, std::vector<double> ms, double error = -1) {
+        std::sort(ms.begin(), ms.end());
+        const size_t k = ms.size();
+        const double median = (k % 2) ? ms[k / 2] : 0.5 * (ms[k / 2 - 1] + ms[k / 2]);
+        const double mean = std::accumulate(ms.begin(), ms.end(), 0.0) / k;
+        char err[32] = "";
+        if (error >= 0) std::snprintf(err, sizeof(err), "%.4e", error);
+        char line[256];
+        std::snprintf(line, sizeof(line), "%s,%d,%d,%s,%zu,%.4f,%.4f,%.4f,%s\n",
+                      ic.c_str(), n, threads, phase.c_str(), k, ms.front(), median, mean, err);
+        out << line << std::flush;
+    }
+};
+
+/**
+ * @brief Runs 'f' once to warm up, then 'repeat' times; f returns its own duration in ms.
+ */
+std::vector<double> measure(int repeat, const std::function<double()>& f) {
+    f();
+    std::vector<double> ms;
+    for (int r = 0; r < repeat; ++r) ms.push_back(f());
+    return ms;
+}
+
+/**
+ * @brief Times one force evaluation of the whole system with 'cfg'. Only the walk itself is
+ * counted (StepState::forceTime), the tree build in front of it has its own phase.
+ */
+double timeForces(ParticleSystem& ps, Octree& tree, const GravityConfig& cfg) {
+    StepState& st = stepState();
+    st.forceTime = 0;
+    computeForces(ps, tree, cfg, 0, static_cast<int>(ps.size()));
+    return st.forceTime * 1e3;
+}
+
+constexpr int kDirectBenchMax = 32768;   // Largest N for which force_direct is timed
+constexpr int kAccuracySample = 1024;    // Targets checked against the direct-sum reference
+
+/**
+ * @brief Accuracy of the tree solvers: reference accelerations of a fixed random sample of
+ * targets from DirectSum::reference(), softened like the leaves of 'tree'.
+ */
+struct AccuracyCheck {
+    std::vector<int> targets;
+    std::vector<real> ax, ay, az;
+
+    AccuracyCheck(const Octree& tree, const ParticleSystem& ps, uint64_t seed) {
+        const int N = static_cast<int>(ps.size());
+        std::mt19937_64 rng(seed);
+        for (int k = 0; k < std::min(N, kAccuracySample); ++k)
+            targets.push_back(N <= kAccuracySample ? k : static_cast<int>(rng() % static_cast<uint64_t>(N)));
+        DirectSum direct;
+        direct.reference(tree, ps, N, targets, ax, ay, az);
+    }
+
+    /** @brief RMS relative error of the accelerations in ps against the reference. */
+    double rmsError(const ParticleSystem& ps) const {
+        double sum = 0;
+        for (size_t k = 0; k < targets.size(); ++k) {
+            const int i = targets[k];
+            const double dx = ps.ax[i] - ax[k], dy = ps.ay[i] - ay[k], dz = ps.az[i] - az[k];
+            const double a2 = double(ax[k]) * ax[k] + double(ay[k]) * ay[k] + double(az[k]) * az[k];
+            if (a2 > 0) sum += (dx * dx + dy * dy + dz * dz) / a2;
+        }
+        return targets.empty() ? 0.0 : std::sqrt(sum / targets.size());
+    }
+};
+
+/**
+ * @brief Times every phase for one configuration; false if a writer produced no file.
+ */
+bool runConfiguration(const BenchOptions& opt, Report& report, const Particle& ic) {
+    omp_set_num_threads(report.threads);
+    stepState() = StepState();
+
+    ParticleSystem ps = ic;
+    const int N = static_cast<int>(ps.size());
+    ps.ax.assign(N, 0); ps.ay.assign(N, 0); ps.az.assign(N, 0);
+    ps.cost.assign(N, 0);
+    Octree tree;
+
+    report.row("reorder", measure(opt.repeat, [&] {
+        ParticleSystem copy = ps;
+        const auto t0 = std::chrono::steady_clock::now();
+        reorderParticles(copy);
+        return msSince(t0);
+    }));
+    reorderParticles(ps);
+
+    report.row("tree_build", measure(opt.repeat, [&] {
+        const auto t0 = std::chrono::steady_clock::now();
+        buildTree(tree, ps);
+        return msSince(t0);
+    }));
+
+    report.row("tree_refit", measure(opt.repeat, [&] {
+        const auto t0 = std::chrono::steady_clock::now();
+        tree.refit(ps, real(1.5), real(0.05));
+        return msSince(t0);
+    }));
+
+    GravityConfig cfg;
+    cfg.theta = opt.theta;
+    cfg.directBelow = 0;    // The tree solvers are timed at every N
+    std::vector<double> ms = measure(opt.repeat, [&] { return timeForces(ps, tree, cfg); });
+    const AccuracyCheck accuracy(tree, ps, opt.seed);
+    report.row("force_particle", ms, accuracy.rmsError(ps));
+
+    GravityConfig group = cfg;
+    group.walk = TreeWalk::Group;
+    ms = measure(opt.repeat, [&] { return timeForces(ps, tree, group); });
+    report.row("force_group", ms, accuracy.rmsError(ps));
+
+    GravityConfig fmm = cfg;
+    fmm.solver = GravitySolver::Fmm;
+    ms = measure(opt.repeat, [&] { return timeForces(ps, tree, fmm); });
+    report.row("force_fmm", ms, accuracy.rmsError(ps));
+
+    // O(N^2): only timed where it could be picked, to keep large runs short.
+    // Its pair softening differs from the tree's, so it gets no error against the reference.
+    if (N <= kDirectBenchMax) {
+        GravityConfig direct = cfg;
+        direct.solver = GravitySolver::Direct;
+        report.row("force_direct", measure(opt.repeat, [&] { return timeForces(ps, tree, direct); }));
+    }
+
+    report.row("drift", measure(opt.repeat, [&] {
+        const auto t0 = std::chrono::steady_clock::now();
+        drift(ps, real(1e-6), 0, N);
+        return msSince(t0);
+    }));
+
+    volatile real sink = 0;
+    report.row("adaptive_dt", measure(opt.repeat, [&] {
+        const auto t0 = std::chrono::steady_clock::now();
+        sink = computeAdaptiveDt(ps, real(0.01));
+        return msSince(t0);
+    }));
+    (void)sink;
+
+    // Whole KDK step with the default solver, as the main loop runs it
+    GravityConfig stepCfg;
+    stepCfg.theta = opt.theta;
+    report.row("step", measure(opt.repeat, [&] {
+        const auto t0 = std::chrono::steady_clock::now();
+        Step(ps, real(1e-4), stepCfg);
+        return msSince(t0);
+    }));
+
+    if (!opt.io) return true;
+
+    // A writer that cannot create its file returns early, so its timing would be meaningless
+    bool written = true;
+    auto timeWriter = [&](const char* phase, const char* ext, void (*save)(const Particle&, const std::string&)) {
+        const std::string base = opt.dir + "/next_bench_snapshot";
+        const std::string path = base + ext;
+        report.row(phase, measure(opt.repeat, [&] {
+            const auto t0 = std::chrono::steady_clock::now();
+            save(ps, path);
+            const double ms = msSince(t0);
+            std::error_code ec;
+            if (std::filesystem::file_size(path, ec) == 0 || ec) {
+                if (written) std::cerr << "next_bench: " << phase << " did not write " << path << "\n";
+                written = false;
+            }
+            std::remove(path.c_str());
+            std::remove((base + ".xdmf").c_str());   // SaveHDF5 also writes an XDMF description
+            return ms;
+        }));
+    };
+    timeWriter("save_vtk", ".vtk", SaveVTK);
+    timeWriter("save_vtk_bin", ".vtk", SaveVTKBinary);
+    timeWriter("save_vtu", ".vtu", SaveVTU);
+    timeWriter("save_vtu_bin", ".vtu", SaveVTUAppended);
+    timeWriter("save_vtu_zlib", ".vtu", SaveVTUCompressed);
+    timeWriter("save_hdf5", ".hdf5", SaveHDF5);
+    return written;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    H5Eset_auto(H5E_DEFAULT, nullptr, nullptr);
+
+    BenchOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        printUsage();
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!opt.out.empty()) {
+        file.open(opt.out);
+        if (!file) { std::cerr << "next_bench: cannot open " << opt.out << "\n"; return 1; }
+    }
+    std::ostream& out = opt.out.empty() ? std::cout : file;
+
+    out << "# next_bench precision=" << precisionName()
+        << " simd=" << forceKernels().name
+        << " max_threads=" << omp_get_max_threads()
+        << " theta=" << opt.theta
+        << " seed=" << opt.seed << "\n";
+    Report::header(out);
+
+    for (const std::string& name : opt.ics) {
+        for (int n : opt.sizes) {
+            Particle ic;
+            makeInitialConditions(name, n, opt.seed, ic);
+            for (int t : opt.threads) {
+                Report report{ out, name, n, t };
+                if (!runConfiguration(opt, report, ic)) return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -16,3 +16,21 @@
 #else
     #error "Define one of: NEXT_FP32 or NEXT_FP64."
 #endif
+
+//---------------------------------------------
+// Force precision: tree moments and gravity kernels
+//---------------------------------------------
+// NEXT_MIXED keeps positions, velocities and integration in FP64 and runs the tree
+// multipoles and force kernels in FP32, on coordinates relative to the node or group.
+#if defined(NEXT_MIXED)
+
+    #if !defined(NEXT_FP64)
+        #error "NEXT_MIXED needs the FP64 particle state (NEXT_FP64)."
+    #endif
+    using treal = float;
+
+#else
+
+    using treal = real;
+
+#endif
@@ -12,11 +12,18 @@
 #include "../argparse/argparse.hpp"
 #include "dt/adaptive.h"
 #include "floatdef.h"
+#include "gravity/kernels.h"
 #include "gravity/step.h"
+#include "io/checkpoint.h"
 #include "io/load_particle.hpp"
+#include "io/lod.h"
+#include "io/projection.h"
 #include "io/vtk_save.h"
 #include "io/vtu_save.h"
 #include "io/hdf5_save.h"
+#include "io/snapshot_writer.h"
+#include "util/profile.h"
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <omp.h>
@@ -29,6 +36,7 @@
 
 
 using next::OutputFormat;
+using next::TimestepMode;
 
 // Helper: only rank 0, thread 0 prints
 inline void log_once(int rank, const std::string &msg) {
@@ -75,59 +83,231 @@ int main(int argc, char **argv) {
 #endif
         std::cout << BANNER << std::endl;
         std::cout << " Threads:   " << args.threads << std::endl;
-#ifdef NEXT_FP64
+#if defined(NEXT_MIXED)
+        std::cout << " Precision: mixed (FP64 state, FP32 forces)" << std::endl;
+#elif defined(NEXT_FP64)
         std::cout << " Precision: FP64" << std::endl;
 #elif defined(NEXT_FP32)
         std::cout << " Precision: FP32" << std::endl;
 #endif
+        std::cout << " SIMD:      " << forceKernels().name << std::endl;
     }
 
-    // Load particles
-    Particle particles = LoadParticlesFromFile(args.input_file);
+    // Load particles, or the exact state of an earlier run; under MPI every rank reads only its own share
+    Particle particles;
+    RunState run;
+    const bool restart = !args.restart.empty();
+    try {
+        if (restart) {
+            particles = ReadCheckpoint(CheckpointPath(args.restart, rank, size), rank, size, run);
+        } else {
+            particles = LoadParticlesFromFile(args.input_file, rank, size);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Loading " << (restart ? args.restart : args.input_file) << " failed: " << e.what() << std::endl;
+#ifdef NEXT_MPI
+        MPI_Abort(MPI_COMM_WORLD, 1);
+#endif
+        return 1;
+    }
+    long long totalParticles = static_cast<long long>(particles.size());
+#ifdef NEXT_MPI
+    // The first step moves the particles to the rank owning their domain
+    if (!restart) assignGlobalIds(particles);
+    MPI_Allreduce(MPI_IN_PLACE, &totalParticles, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    // Every rank's piece has to come from the same checkpoint
+    long long stepRange[2] = { run.steps, -run.steps };
+    MPI_Allreduce(MPI_IN_PLACE, stepRange, 2, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+    if (stepRange[0] != -stepRange[1]) {
+        if (rank == 0) std::cerr << "The pieces of checkpoint " << args.restart << " are from different steps" << std::endl;
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+#endif
     if (rank == 0 && omp_get_thread_num() == 0) {
-        std::cout << " Particles: " << particles.size() << std::endl;
+        std::cout << " Particles: " << totalParticles << std::endl;
+        const bool direct = args.gravity.solver == GravitySolver::Direct ||
+                            totalParticles < args.gravity.directBelow;
+        std::cout << " Solver:    "
+                  << (direct ? "direct summation"
+                             : args.gravity.solver == GravitySolver::Fmm ? "FMM" : "Barnes-Hut") << std::endl;
+        if (restart) {
+            std::cout << " Restart:   " << args.restart << " (step " << run.steps << ", t = " << run.simTime << ")" << std::endl;
+        }
     }
 
-    real simTime = 0;
-    real nextDump = 0;
-    int step = 0;
+    // Per-phase timings (NEXT_PROFILE builds): profile.json for chrome://tracing or Perfetto, profile.csv per step
+    NEXT_PROFILE_OPEN(size > 1 ? "profile_rank" + std::to_string(rank) : std::string("profile"), rank);
+
+    // Snapshots are copied and written by a background thread while the next steps run
+    SnapshotWriter writer(args.io_buffers);
+#ifdef NEXT_PROFILE
+    long long bytesReported = 0;
+#endif
+
+    // Projected maps written in situ, so full snapshots can be rarer
+    ProjectionMaps maps(args.map_size, args.map_axes, static_cast<real>(args.map_extent), args.map_by_type);
+    if (restart) maps.setWindow(run.mapWindow);
+
+    // Level-of-detail dumps: coarse tree nodes as pseudo-particles instead of every particle
+    LodConfig lodConfig;
+    lodConfig.maxDepth = args.lod_depth;
+    lodConfig.maxMass = static_cast<real>(args.lod_mass);
+    lodConfig.roiX = static_cast<real>(args.lod_roi[0]);
+    lodConfig.roiY = static_cast<real>(args.lod_roi[1]);
+    lodConfig.roiZ = static_cast<real>(args.lod_roi[2]);
+    lodConfig.roiHalf = static_cast<real>(args.lod_roi[3]);
+    LodBuilder lod(lodConfig);
+
+    real simTime = static_cast<real>(run.simTime);
+    real nextDump = static_cast<real>(run.nextDump);
+    int step = static_cast<int>(run.dumps);
+    long long steps = run.steps;
+    stepState().stepCount = run.stepCount;
+    stepState().theta = static_cast<real>(run.theta);
     char command;
 
     while (true) {
-        real dtAdaptive = computeAdaptiveDt(particles, args.dt);
-        Step(particles, dtAdaptive);
+        real dtAdaptive;
+        if (args.timesteps == TimestepMode::Block) {
+            // Every particle picks its own sub-step inside the base dt
+            dtAdaptive = args.dt;
+            StepBlock(particles, dtAdaptive, args.gravity);
+        } else {
+            {
+                NEXT_PROFILE_SCOPE("dt");
+                dtAdaptive = computeAdaptiveDt(particles, args.dt);
+            }
+            Step(particles, dtAdaptive, args.gravity);
+        }
         simTime += dtAdaptive;
+        ++steps;
 
         if (simTime >= nextDump) {
             std::string out = "dump_" + std::to_string(step);
+#ifdef NEXT_MPI
+            // Every rank writes the particles of its own domain, to its own file unless the
+            // ranks share one parallel HDF5 file
+            bool sharedFile = false;
+#ifdef NEXT_PARALLEL_HDF5
+            sharedFile = args.format == OutputFormat::HDF5;
+#endif
+            if (size > 1 && !sharedFile) out += "_rank" + std::to_string(rank);
+#endif
 
-            switch (args.format) {
-                case OutputFormat::VTK:  out += ".vtk";  SaveVTK(particles, out);  break;
-                case OutputFormat::VTU:  out += ".vtu";  SaveVTU(particles, out);  break;
-                case OutputFormat::HDF5: out += ".hdf5"; SaveHDF5(particles, out); break;
+            const Particle* snapshot = &particles;
+            if (lodConfig.enabled()) {
+                NEXT_PROFILE_SCOPE("dump.lod");
+                snapshot = &lod.build(particles);
+                NEXT_PROFILE_COUNTER("dump.lod_particles", snapshot->size());
             }
 
+            {
+                // Staging (and waiting for a free buffer); the write itself runs in the background
+                NEXT_PROFILE_SCOPE("dump");
+                switch (args.format) {
+                    case OutputFormat::VTK:  out += ".vtk";  writer.submit(*snapshot, out, SaveVTK);  break;
+                    case OutputFormat::VTKBinary: out += ".vtk"; writer.submit(*snapshot, out, SaveVTKBinary); break;
+                    case OutputFormat::VTU:  out += ".vtu";  writer.submit(*snapshot, out, SaveVTU);  break;
+                    case OutputFormat::VTUBinary: out += ".vtu"; writer.submit(*snapshot, out, SaveVTUAppended); break;
+                    case OutputFormat::VTUZlib:   out += ".vtu"; writer.submit(*snapshot, out, SaveVTUCompressed); break;
+                    case OutputFormat::HDF5:
+                        out += ".hdf5";
+#ifdef NEXT_PARALLEL_HDF5
+                        // Collective MPI-IO: all ranks at once, from the main thread, so not queued
+                        SaveHDF5Parallel(*snapshot, out);
+#else
+                        writer.submit(*snapshot, out, SaveHDF5);
+#endif
+                        break;
+                }
+            }
+#ifdef NEXT_PROFILE
+            // Bytes of the snapshots finished since the last dump
+            const long long bytesWritten = writer.stats().bytes;
+            NEXT_PROFILE_COUNTER("dump.bytes", bytesWritten - bytesReported);
+            bytesReported = bytesWritten;
+#endif
+
             if (rank == 0 && omp_get_thread_num() == 0) {
                 std::cout << "[Dump " << step << "] t = " << simTime
-                          << ", file: " << out << std::endl;
+                          << ", file: " << out
+                          << (lodConfig.enabled() ? " (" + std::to_string(snapshot->size()) + " LOD particles)" : std::string())
+                          << ", force imbalance: ranks " << stepState().rankImbalance * 100 << "%"
+                          << ", threads " << stepState().threadImbalance * 100 << "%";
+                if (args.gravity.forceError > 0) {
+                    std::cout << ", theta " << stepState().theta
+                              << " (force error " << stepState().tuner.error
+                              << (stepState().tuner.met ? ")" : ", over budget even at the smallest angle)");
+                }
+                std::cout << std::endl;
             }
 
             nextDump += args.dump_interval;
             step++;
         }
 
+        if (args.map_interval > 0 && steps % args.map_interval == 0) {
+            NEXT_PROFILE_SCOPE("map");
+            // Numbered by step, in the window the checkpoints keep, so the frames stay in sequence across restarts
+            const std::string out = "map_" + std::to_string(steps / args.map_interval);
+#ifdef NEXT_PROFILE
+            const long long bytes = maps.write(particles, out);
+            NEXT_PROFILE_COUNTER("map.bytes", bytes);
+#else
+            maps.write(particles, out);
+#endif
+        }
+
         // Non-blocking exit check
-        if (std::cin.rdbuf()->in_avail() > 0) {
-            std::cin >> command;
-            if (command == 'q' || command == 'Q') {
+        int quit = 0;
+        {
+            NEXT_PROFILE_SCOPE("console");
+            if (rank == 0 && std::cin.rdbuf()->in_avail() > 0) {
+                std::cin >> command;
+                quit = (command == 'q' || command == 'Q');
+            }
+#ifdef NEXT_MPI
+            // Only rank 0 reads the console; all ranks have to leave the loop together
+            MPI_Bcast(&quit, 1, MPI_INT, 0, MPI_COMM_WORLD);
+#endif
+        }
+
+        // Exact state for a restart, every checkpoint_interval steps and when leaving
+        if (args.checkpoint_interval > 0 && (steps % args.checkpoint_interval == 0 || quit)) {
+            NEXT_PROFILE_SCOPE("checkpoint");
+            run = RunState{ simTime, nextDump, steps, step, stepState().stepCount, stepState().theta };
+            maps.window(run.mapWindow);
+            try {
+                const std::string path = CheckpointPath(args.checkpoint, rank, size);
+#ifdef NEXT_PROFILE
+                const long long bytes = WriteCheckpoint(particles, run, rank, size, path);
+                NEXT_PROFILE_COUNTER("checkpoint.bytes", bytes);
+#else
+                WriteCheckpoint(particles, run, rank, size, path);
+#endif
                 if (rank == 0 && omp_get_thread_num() == 0) {
-                    std::cout << "Exiting..." << std::endl;
+                    std::cout << "[Checkpoint] step " << steps << ", t = " << simTime
+                              << ", file: " << path << std::endl;
                 }
-                break;
+            } catch (const std::exception& e) {
+                // A failed checkpoint should not end a long run; the previous one is still intact
+                std::cerr << e.what() << std::endl;
             }
         }
+        NEXT_PROFILE_END_STEP(stepState().stepCount);
+        if (quit) {
+            if (rank == 0 && omp_get_thread_num() == 0) {
+                std::cout << "Exiting..." << std::endl;
+            }
+            break;
+        }
     }
 
+    // Let the last snapshots reach the disk
+    writer.close();
+    NEXT_PROFILE_CLOSE();
+
 #ifdef NEXT_MPI
     MPI_Finalize();
 #endif
@@ -15,9 +15,13 @@
 #include <algorithm>
 #include <cmath>
 #include <vector>
+#ifdef NEXT_MPI
+    #include "parallel/mpi_types.h"
+#endif
 
 /**
- * @brief Computes a global adaptive time-step based on the maximum velocity in the system.
+ * @brief Computes a global adaptive time-step based on the maximum velocity in the system
+ * (over all ranks under MPI).
  * Updated for SoA (Structure of Arrays) for better cache performance.
  */
 real computeAdaptiveDt(const Particle &p, real base_dt) {
@@ -32,6 +36,11 @@ real computeAdaptiveDt(const Particle &p, real base_dt) {
             maxSpeedSq = speedSq;
     }
 
+#ifdef NEXT_MPI
+    // Every rank must take the same step
+    MPI_Allreduce(MPI_IN_PLACE, &maxSpeedSq, 1, mpiRealType(), MPI_MAX, MPI_COMM_WORLD);
+#endif
+
     real maxSpeed = std::sqrt(maxSpeedSq);
     
     // Safety clamp to prevent dt from exploding or becoming zero
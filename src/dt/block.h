@@ -0,0 +1,51 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "dt/softening.h"
+#include "struct/particle.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Rung for the local criterion dt_i = sqrt(2 * eta * eps_i / |a_i|).
+ * Rung r means a step of dtMax / 2^r; the result is the coarsest rung whose step
+ * does not exceed dt_i, clamped to [0, maxRung]. eps_i is the particle's softening length.
+ */
+inline int rungFor(real ax, real ay, real az, real m, real dtMax, real eta, int maxRung) {
+    real a = std::sqrt(ax * ax + ay * ay + az * az);
+    if (!(a > real(0))) return 0;
+
+    real eps = pairSoftening(m, m);
+    real dt = std::sqrt(real(2.0) * eta * eps / a);
+    if (dt >= dtMax) return 0;
+
+    int r = static_cast<int>(std::ceil(std::log2(dtMax / dt)));
+    return std::min(std::max(r, 0), maxRung);
+}
+
+/**
+ * @brief Assigns new rungs to the particles in [start, end) (only the active ones if 'active' is given).
+ * At time t (in units of dtMax / 2^maxRung) a particle may only move to a rung whose step
+ * boundaries include t, so a wanted coarser rung is refined until it is synchronised.
+ */
+inline void assignRungs(Particle& p, int start, int end, real dtMax, real eta, int maxRung, long long t,
+                        const std::vector<unsigned char>* active = nullptr) {
+    #pragma omp parallel for schedule(static)
+    for (int i = start; i < end; ++i) {
+        if (active && !(*active)[i]) continue;
+        int r = rungFor(p.ax[i], p.ay[i], p.az[i], p.m[i], dtMax, eta, maxRung);
+        while (r < maxRung && t % (1LL << (maxRung - r)) != 0) ++r;
+        p.rung[i] = r;
+    }
+}
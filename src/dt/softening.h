@@ -17,21 +17,22 @@
 /**
  * @brief Softening for Barnes-Hut node interactions.
  * Note: nodeMass and dist are passed as individual reals from the SoA arrays.
+ * Evaluated in the force precision (treal), like the rest of the node kernels.
  */
-inline real nextSoftening(real nodeSize, real nodeMass, real dist) {
+inline treal nextSoftening(treal nodeSize, treal nodeMass, treal dist) {
     // std::pow(x, 1/3) or std::cbrt is slow. 
     // In SoA loops, this is often the bottleneck.
-    real eps_size = nodeSize * real(0.015);
-    real eps_mass = std::cbrt(nodeMass) * real(0.002);
+    treal eps_size = nodeSize * treal(0.015);
+    treal eps_mass = std::cbrt(nodeMass) * treal(0.002);
 
     // Distance taper: strong at r->0, fades smoothly
-    real eps_taper = real(1.0) / (real(1.0) + dist * real(10.0));
+    treal eps_taper = treal(1.0) / (treal(1.0) + dist * treal(10.0));
 
     // Combine
-    real eps = (eps_size + eps_mass) * eps_taper;
+    treal eps = (eps_size + eps_mass) * eps_taper;
 
     // Minimum floor - using std::max is cleaner and easier for the compiler to optimize
-    return std::max(eps, real(1e-4));
+    return std::max(eps, treal(1e-4));
 }
 
 /**
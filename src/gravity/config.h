@@ -0,0 +1,59 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+
+/**
+ * @brief Tree walk used for the Barnes-Hut forces.
+ */
+enum class TreeWalk {
+    Particle,   // One walk per target, summed with the SIMD kernels (listAccel)
+    Group       // One walk per group of nearby targets with shared interaction lists
+};
+
+/**
+ * @brief Algorithm used for the gravitational accelerations.
+ */
+enum class GravitySolver {
+    BarnesHut,  // Per-target tree walks (see TreeWalk)
+    Fmm,        // Dual-tree Fast Multipole Method (gravity/fmm.h)
+    Direct      // Tiled O(N^2) direct summation (gravity/direct.h)
+};
+
+/**
+ * @brief How the tree follows the particles between force evaluations.
+ */
+enum class TreeUpdate {
+    Rebuild,    // Build a new tree for every force evaluation
+    Refit       // Keep the topology and refit sizes and moments until the tree degrades
+};
+
+/**
+ * @brief Run-time settings of the gravity solver used by Step().
+ */
+struct GravityConfig {
+    real theta = real(0.5);     // Opening angle (Barnes-Hut and FMM); the starting value when tuned
+    real forceError = real(0);  // Target RMS relative force error; > 0 tunes theta to it (gravity/thetatune.h)
+    int thetaInterval = 16;     // Re-tune theta every N steps
+    int thetaSample = 128;      // Targets per rank whose forces are checked against direct summation
+    GravitySolver solver = GravitySolver::BarnesHut;
+    long long directBelow = 0;      // Use direct summation while the total particle count is below this (0 = never); opt-in, as it softens differently
+    int reorderInterval = 4;    // Sort particles along a Morton curve every N steps (0 = never)
+    int decomposeInterval = 16; // Under MPI, rebalance the domains at least every N steps, even with reordering off (0 = never)
+    TreeWalk walk = TreeWalk::Particle;
+    int groupSize = 16;         // Maximum number of targets per group for TreeWalk::Group
+    TreeUpdate treeUpdate = TreeUpdate::Rebuild;
+    real refitGrowth = real(1.5);   // Rebuild once a node must grow beyond this factor of its cell
+    real refitEscaped = real(0.05); // ... or once this fraction of particles has left its leaf cell
+    real blockEta = real(0.025);  // Accuracy parameter of the block-timestep criterion (StepBlock)
+    int maxRung = 10;           // Finest block-timestep rung: dtMax / 2^maxRung
+};
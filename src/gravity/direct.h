@@ -0,0 +1,225 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "kernels.h"
+#include "octree.h"
+#include "struct/particle.h"
+#include "util/profile.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <omp.h>
+#ifdef NEXT_MPI
+    #include <mpi.h>
+    #include "parallel/mpi_types.h"
+#endif
+
+/**
+ * @brief Tiled O(N^2) direct summation, softened with pairSoftening() like GravitySoA.
+ * The sources are cut into blocks of kBlockJ particles that stay in L1 while a block of
+ * kBlockI targets runs over them with the SIMD pair kernel picked for this CPU (see kernels.h);
+ * OpenMP threads share out the target blocks. Each source block is shifted to an origin at the
+ * first target of the block, so the kernels can run in the force precision 'treal', and every
+ * block sum is added in the state precision.
+ *
+ * Exact up to round-off. Under MPI every rank gathers the particles of all ranks as sources.
+ * reference() runs the same summation with the tree's leaf softening, as the ground truth
+ * for the accuracy of the tree solvers (theta tuning, next_bench).
+ */
+struct DirectSum {
+    static constexpr int kBlockJ = 512;   // Sources per cache block (multiple of kSimdPad)
+    static constexpr int kBlockI = 64;    // Targets per OpenMP work item
+
+    /**
+     * @brief Stores the accelerations of the targets in [start, end) in ps.ax/ay/az.
+     * If 'active' is given, only targets with active[i] != 0 are evaluated. The source count
+     * goes to ps.cost if that lane is sized; if 'threadBusy' is given, thread t adds the time
+     * it spent working to threadBusy[t].
+     */
+    void accel(ParticleSystem& ps, int start, int end, const std::vector<unsigned char>* active = nullptr,
+               double* threadBusy = nullptr) {
+        {
+            NEXT_PROFILE_SCOPE("direct.sources");
+            gatherSources(ps, static_cast<int>(ps.size()));
+        }
+        const int nSources = static_cast<int>(m.size());
+        const int blocks = (end - start + kBlockI - 1) / kBlockI;
+        const PairKernel kernel = forceKernels().pair;
+        const bool recordCost = static_cast<int>(ps.cost.size()) >= end;
+
+        #pragma omp parallel
+        {
+            NEXT_PROFILE_SCOPE("force.thread");
+            const double t0 = omp_get_wtime();
+            std::vector<treal> jx(kBlockJ), jy(kBlockJ), jz(kBlockJ), jm(kBlockJ), je2(kBlockJ);
+            std::vector<int> targets;
+            std::vector<real> acc;
+
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int b = 0; b < blocks; ++b) {
+                targets.clear();
+                const int i1 = std::min(start + (b + 1) * kBlockI, end);
+                for (int i = start + b * kBlockI; i < i1; ++i) {
+                    if (!active || (*active)[i]) targets.push_back(i);
+                }
+                if (targets.empty()) continue;
+
+                const real ox = ps.x[targets[0]], oy = ps.y[targets[0]], oz = ps.z[targets[0]];
+                acc.assign(3 * targets.size(), real(0));
+
+                for (int j0 = 0; j0 < nSources; j0 += kBlockJ) {
+                    const int n = std::min(kBlockJ, nSources - j0);
+                    for (int k = 0; k < n; ++k) {
+                        jx[k] = treal(sx[j0 + k] - ox); jy[k] = treal(sy[j0 + k] - oy); jz[k] = treal(sz[j0 + k] - oz);
+                        jm[k] = m[j0 + k]; je2[k] = e2[j0 + k];
+                    }
+                    // Massless padding up to the SIMD width
+                    const int padded = (n + kSimdPad - 1) / kSimdPad * kSimdPad;
+                    for (int k = n; k < padded; ++k) { jx[k] = jy[k] = jz[k] = jm[k] = je2[k] = 0; }
+                    const PairView J{ jx.data(), jy.data(), jz.data(), jm.data(), je2.data(), padded };
+
+                    for (size_t t = 0; t < targets.size(); ++t) {
+                        const int i = targets[t];
+                        treal a[3] = { 0, 0, 0 };
+                        kernel(J, treal(ps.x[i] - ox), treal(ps.y[i] - oy), treal(ps.z[i] - oz), selfE2[i - start], a);
+                        acc[3 * t] += a[0]; acc[3 * t + 1] += a[1]; acc[3 * t + 2] += a[2];
+                    }
+                }
+
+                for (size_t t = 0; t < targets.size(); ++t) {
+                    const int i = targets[t];
+                    ps.ax[i] = acc[3 * t]; ps.ay[i] = acc[3 * t + 1]; ps.az[i] = acc[3 * t + 2];
+                    if (recordCost) ps.cost[i] = real(nSources);
+                }
+            }
+
+            if (threadBusy) threadBusy[omp_get_thread_num()] += omp_get_wtime() - t0;
+        }
+    }
+
+    /**
+     * @brief Ground-truth accelerations for the tree solvers: for every index in 'targets', the
+     * sum over the particles [0, count) of all ranks goes to ax/ay/az. Each source is softened
+     * like the leaf holding it in 'tree' (nodeSoftening() with the leaf's size, Dark Matter floor
+     * included), which is what a single-rank tree walk converges to as theta goes to 0. Unlike a
+     * theta = 0 walk of the locally essential tree, remote particles are summed exactly.
+     * Collective under MPI.
+     */
+    void reference(const Octree& tree, const ParticleSystem& ps, int count, const std::vector<int>& targets,
+                   std::vector<real>& ax, std::vector<real>& ay, std::vector<real>& az) {
+        std::vector<real> leafSize(count, real(0));
+        for (const OctreeNode& node : tree.nodes) {
+            if (node.leaf && node.bodyIdx >= 0 && node.bodyIdx < count) leafSize[node.bodyIdx] = node.size;
+        }
+        gatherSources(ps, count, &leafSize);
+
+        const int nSources = static_cast<int>(m.size());
+        const int K = static_cast<int>(targets.size());
+        const ListKernel kernel = forceKernels().particle;
+        ax.assign(K, real(0)); ay.assign(K, real(0)); az.assign(K, real(0));
+
+        #pragma omp parallel
+        {
+            std::vector<treal> jx(kBlockJ), jy(kBlockJ), jz(kBlockJ), jm(kBlockJ), jBase(kBlockJ), jDM(kBlockJ);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int k = 0; k < K; ++k) {
+                const int i = targets[k];
+                const treal dmScale = (ps.type[i] == 1) ? treal(std::cbrt(ps.m[i])) : treal(0);
+                for (int j0 = 0; j0 < nSources; j0 += kBlockJ) {
+                    const int n = std::min(kBlockJ, nSources - j0);
+                    for (int q = 0; q < n; ++q) {
+                        jx[q] = treal(sx[j0 + q] - ps.x[i]); jy[q] = treal(sy[j0 + q] - ps.y[i]); jz[q] = treal(sz[j0 + q] - ps.z[i]);
+                        jm[q] = m[j0 + q]; jBase[q] = epsBase[j0 + q]; jDM[q] = epsDM[j0 + q];
+                    }
+                    const int padded = (n + kSimdPad - 1) / kSimdPad * kSimdPad;
+                    for (int q = n; q < padded; ++q) { jx[q] = jy[q] = jz[q] = jm[q] = jBase[q] = jDM[q] = 0; }
+                    const ListView L{ jx.data(), jy.data(), jz.data(), jm.data(), jBase.data(), jDM.data(),
+                                      nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, padded };
+
+                    // A source at the target's own position adds nothing
+                    treal a[3] = { 0, 0, 0 };
+                    kernel(L, 0, 0, 0, dmScale, a);
+                    ax[k] += a[0]; ay[k] += a[1]; az[k] += a[2];
+                }
+            }
+        }
+    }
+
+private:
+    const real *sx = nullptr, *sy = nullptr, *sz = nullptr;  // Source positions: ps itself, or all ranks under MPI
+#ifdef NEXT_MPI
+    std::vector<real> x, y, z;      // Gathered positions
+#endif
+    std::vector<treal> m, e2;       // Source masses and squared softening shares
+    std::vector<treal> selfE2;      // Softening shares of the local targets
+    std::vector<treal> epsBase, epsDM;  // Leaf softening terms of the sources (reference() only), as in InteractionList
+
+    /**
+     * @brief Squared softening share of one particle: pairSoftening(a, b)^2 is the sum of both
+     * shares, floored at (1e-4)^2.
+     */
+    static treal softeningShare(real mass) {
+        const real e = std::cbrt(mass) * real(0.002);
+        return treal(e * e);
+    }
+
+    /**
+     * @brief Collects the particles [0, nLocal) of every rank as sources. With 'leafSize' (one
+     * per local particle) the leaf softening terms are set up as well.
+     */
+    void gatherSources(const ParticleSystem& ps, int nLocal, const std::vector<real>* leafSize = nullptr) {
+        selfE2.resize(nLocal);
+        for (int i = 0; i < nLocal; ++i) selfE2[i] = softeningShare(ps.m[i]);
+
+#ifdef NEXT_MPI
+        int ranks = 1;
+        MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+        std::vector<int> counts(ranks), offsets(ranks, 0);
+        MPI_Allgather(&nLocal, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        for (int r = 1; r < ranks; ++r) offsets[r] = offsets[r - 1] + counts[r - 1];
+        const int total = offsets[ranks - 1] + counts[ranks - 1];
+
+        std::vector<real> mass(total);
+        x.resize(total); y.resize(total); z.resize(total);
+        const MPI_Datatype type = mpiRealType();
+        MPI_Allgatherv(ps.x.data(), nLocal, type, x.data(), counts.data(), offsets.data(), type, MPI_COMM_WORLD);
+        MPI_Allgatherv(ps.y.data(), nLocal, type, y.data(), counts.data(), offsets.data(), type, MPI_COMM_WORLD);
+        MPI_Allgatherv(ps.z.data(), nLocal, type, z.data(), counts.data(), offsets.data(), type, MPI_COMM_WORLD);
+        MPI_Allgatherv(ps.m.data(), nLocal, type, mass.data(), counts.data(), offsets.data(), type, MPI_COMM_WORLD);
+        std::vector<real> sizes;
+        if (leafSize) {
+            sizes.resize(total);
+            MPI_Allgatherv(leafSize->data(), nLocal, type, sizes.data(), counts.data(), offsets.data(), type, MPI_COMM_WORLD);
+        }
+        sx = x.data(); sy = y.data(); sz = z.data();
+#else
+        const int total = nLocal;
+        const real* mass = ps.m.data();
+        const real* sizes = leafSize ? leafSize->data() : nullptr;
+        sx = ps.x.data(); sy = ps.y.data(); sz = ps.z.data();
+#endif
+        m.resize(total); e2.resize(total);
+        for (int j = 0; j < total; ++j) {
+            m[j] = treal(mass[j]);
+            e2[j] = softeningShare(mass[j]);
+        }
+        if (!leafSize) return;
+        epsBase.resize(total); epsDM.resize(total);
+        for (int j = 0; j < total; ++j) {
+            const treal size = treal(sizes[j]), cm = std::cbrt(treal(mass[j]));
+            epsBase[j] = size * treal(0.015) + cm * treal(0.002);
+            epsDM[j] = cm > 0 ? treal(2.0) * size / cm : treal(0);
+        }
+    }
+};
@@ -0,0 +1,274 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "octree.h"
+#include "dt/softening.h"
+#include "struct/particle.h"
+#include "util/profile.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Second-order local expansion of the acceleration field around a node's center of mass:
+ * a_i(x) = a0_i + J_ij d_j + K_ijk d_j d_k / 2 with d = x - c. J is the (symmetric) gradient of
+ * the far-field acceleration and K its (fully symmetric) second derivative.
+ * Kept in the state precision: it sums many M2L terms and is shifted down the whole tree.
+ */
+struct LocalExpansion {
+    real ax, ay, az;
+    real Jxx, Jyy, Jzz, Jxy, Jxz, Jyz;
+    real Kxxx, Kyyy, Kzzz, Kxxy, Kxxz, Kxyy, Kyyz, Kxzz, Kyzz, Kxyz;
+};
+
+/**
+ * @brief Fast Multipole Method on top of the Barnes-Hut octree.
+ * The multipoles are the monopole and quadrupole moments already stored in the nodes.
+ * A dual-tree traversal pairs target and source nodes: well separated pairs become
+ * multipole-to-local (M2L) translations, single-particle targets take the source directly
+ * with the same softening as bhAccel (including the Dark Matter rule), and everything else
+ * is split further. A downward pass then shifts every local expansion into its children
+ * (L2L); leaves hold one particle at their center, so their expansion is its acceleration.
+ *
+ * M2L carries the field of the monopole and quadrupole, their gradients, and the second
+ * derivative of the monopole field, so the local expansions are second order. The error at a
+ * given theta is then comparable to the quadrupole Barnes-Hut walk (--solver bh).
+ *
+ * Cell-cell interactions are softened with nextSoftening(); the per-target Dark Matter floor
+ * needs the target's own mass and is only applied where the target is a single particle.
+ */
+struct Fmm {
+    std::vector<LocalExpansion> locals;
+    std::vector<real> work;      // Interactions per node, turned into a per-particle share by push()
+
+    /**
+     * @brief Stores the accelerations of the targets in [start, end) in ps.ax/ay/az.
+     * 'tree' must be built over the current positions. If 'active' is given, only targets
+     * with active[i] != 0 are written (the traversal itself always covers the whole tree).
+     * The interactions of every target, including its share of the M2L work of the cells
+     * above it, go to ps.cost if that lane is sized.
+     */
+    void accel(const Octree& tree, ParticleSystem& ps, real theta, int start, int end,
+               const std::vector<unsigned char>* active = nullptr) {
+        if (tree.empty()) return;
+        nodes = tree.nodes.data();
+        p = &ps;
+        theta2 = theta * theta;
+        locals.assign(tree.nodes.size(), LocalExpansion{});
+        work.assign(tree.nodes.size(), real(0));
+
+        #pragma omp parallel
+        #pragma omp single
+        {
+            {
+                NEXT_PROFILE_SCOPE("fmm.interact");
+                interact(0, 0);
+            }
+            NEXT_PROFILE_SCOPE("fmm.push");
+            work[0] /= real(std::max(nodes[0].count, 1));
+            push(0);
+        }
+
+        const int count = static_cast<int>(tree.nodes.size());
+        const bool recordCost = static_cast<int>(ps.cost.size()) >= end;
+        #pragma omp parallel for schedule(static)
+        for (int n = 0; n < count; ++n) {
+            const OctreeNode& node = nodes[n];
+            const int i = node.bodyIdx;
+            if (!node.leaf || i < start || i >= end) continue;
+            if (active && !(*active)[i]) continue;
+            ps.ax[i] = locals[n].ax; ps.ay[i] = locals[n].ay; ps.az[i] = locals[n].az;
+            if (recordCost) ps.cost[i] = work[n];
+        }
+    }
+
+private:
+    static constexpr int kTaskMin = 2048;     // Smallest target subtree handed to its own task
+
+    const OctreeNode* nodes = nullptr;
+    const ParticleSystem* p = nullptr;
+    real theta2 = real(0.25);
+
+    /**
+     * @brief Radius of the source region of a node: zero for a single particle, otherwise the half-width.
+     */
+    real radius(const OctreeNode& node) const { return node.leaf ? real(0) : node.size; }
+
+    /**
+     * @brief Applies all interactions of source node b on target node a.
+     * Only a's subtree is written, so the children of a split target can run as parallel tasks.
+     */
+    void interact(int a, int b) {
+        const OctreeNode& A = nodes[a];
+        const OctreeNode& B = nodes[b];
+        if (B.m == 0 || A.m == 0) return;
+
+        if (A.leaf) {
+            particleFromNode(a, b);
+            return;
+        }
+
+        real dx = B.cx - A.cx;
+        real dy = B.cy - A.cy;
+        real dz = B.cz - A.cz;
+        real r2 = dx*dx + dy*dy + dz*dz;
+        real s = A.size + radius(B);
+        if (a != b && s * s < theta2 * r2) {
+            cellFromCell(locals[a], B, treal(dx), treal(dy), treal(dz));
+            work[a] += real(1);
+            return;
+        }
+
+        if (B.leaf || A.size >= B.size) {
+            const bool spawn = A.count >= kTaskMin;
+            for (int c : A.child) {
+                if (c < 0) continue;
+                #pragma omp task if(spawn) firstprivate(c, b)
+                interact(c, b);
+            }
+            #pragma omp taskwait
+        } else {
+            for (int c : B.child) {
+                if (c >= 0) interact(a, c);
+            }
+        }
+    }
+
+    /**
+     * @brief Single-particle target a: the same opening test and kernel as bhAccelNode.
+     */
+    void particleFromNode(int a, int b) {
+        const OctreeNode& A = nodes[a];
+        const OctreeNode& B = nodes[b];
+        const int i = A.bodyIdx;
+        if (B.leaf && B.bodyIdx == i) return;
+
+        treal dx = treal(B.cx - A.cx);
+        treal dy = treal(B.cy - A.cy);
+        treal dz = treal(B.cz - A.cz);
+        treal r2 = dx*dx + dy*dy + dz*dz;
+        treal dist = std::sqrt(r2 + treal(1e-20));
+
+        if (B.leaf || (B.size / dist) * (B.size / dist) < theta2) {
+            treal eps = nodeSoftening(B, dist, p->type[i], treal(p->m[i]));
+            treal dist_inv = treal(1.0) / std::sqrt(r2 + eps*eps);
+            LocalExpansion& L = locals[a];
+            multipoleAccel(B, dx, dy, dz, dist_inv, L.ax, L.ay, L.az);
+            work[a] += real(1);
+            return;
+        }
+
+        for (int c : B.child) {
+            if (c >= 0) particleFromNode(a, c);
+        }
+    }
+
+    /**
+     * @brief M2L: field, field gradient and second derivative of B's multipole at the center of
+     * the target cell. (dx, dy, dz) points from the target center to B.
+     */
+    static void cellFromCell(LocalExpansion& L, const OctreeNode& B, treal dx, treal dy, treal dz) {
+        constexpr treal G = treal(1.0);
+        treal r2 = dx*dx + dy*dy + dz*dz;
+        treal dist = std::sqrt(r2);
+        treal eps = nextSoftening(B.size, B.m, dist);
+        treal dist_inv = treal(1.0) / std::sqrt(r2 + eps*eps);
+
+        multipoleAccel(B, dx, dy, dz, dist_inv, L.ax, L.ay, L.az);
+
+        // Gradient of the monopole field
+        treal inv2 = dist_inv * dist_inv;
+        treal inv3 = inv2 * dist_inv;
+        treal gm3 = G * B.m * inv3;
+        treal gm5 = treal(3.0) * gm3 * inv2;
+        L.Jxx += gm5 * dx * dx - gm3;
+        L.Jyy += gm5 * dy * dy - gm3;
+        L.Jzz += gm5 * dz * dz - gm3;
+        L.Jxy += gm5 * dx * dy;
+        L.Jxz += gm5 * dx * dz;
+        L.Jyz += gm5 * dy * dz;
+
+        // Gradient of the quadrupole field: -d/dd_j of Q_ij d_j / r^5 - 5/2 q d_i / r^7
+        treal inv5 = inv3 * inv2;
+        treal inv7 = inv5 * inv2;
+        treal inv9 = inv7 * inv2;
+        treal Qdx = B.Qxx*dx + B.Qxy*dy + B.Qxz*dz;
+        treal Qdy = B.Qxy*dx + B.Qyy*dy + B.Qyz*dz;
+        treal Qdz = B.Qxz*dx + B.Qyz*dy + B.Qzz*dz;
+        treal q = dx*Qdx + dy*Qdy + dz*Qdz;
+        treal c7 = treal(5.0) * G * inv7;
+        treal c9 = treal(17.5) * G * q * inv9;
+        treal diag = treal(2.5) * G * q * inv7;
+        L.Jxx += -G * B.Qxx * inv5 + c7 * (2 * Qdx * dx) + diag - c9 * dx * dx;
+        L.Jyy += -G * B.Qyy * inv5 + c7 * (2 * Qdy * dy) + diag - c9 * dy * dy;
+        L.Jzz += -G * B.Qzz * inv5 + c7 * (2 * Qdz * dz) + diag - c9 * dz * dz;
+        L.Jxy += -G * B.Qxy * inv5 + c7 * (Qdx * dy + Qdy * dx) - c9 * dx * dy;
+        L.Jxz += -G * B.Qxz * inv5 + c7 * (Qdx * dz + Qdz * dx) - c9 * dx * dz;
+        L.Jyz += -G * B.Qyz * inv5 + c7 * (Qdy * dz + Qdz * dy) - c9 * dy * dz;
+
+        // Second derivative of the monopole field: 15 d_i d_j d_k / r^7 - 3 (delta_ij d_k + ...) / r^5
+        treal gm7 = treal(5.0) * gm5 * inv2;
+        L.Kxxx += gm7 * dx * dx * dx - 3 * gm5 * dx;
+        L.Kyyy += gm7 * dy * dy * dy - 3 * gm5 * dy;
+        L.Kzzz += gm7 * dz * dz * dz - 3 * gm5 * dz;
+        L.Kxxy += gm7 * dx * dx * dy - gm5 * dy;
+        L.Kxxz += gm7 * dx * dx * dz - gm5 * dz;
+        L.Kxyy += gm7 * dx * dy * dy - gm5 * dx;
+        L.Kyyz += gm7 * dy * dy * dz - gm5 * dz;
+        L.Kxzz += gm7 * dx * dz * dz - gm5 * dx;
+        L.Kyzz += gm7 * dy * dz * dz - gm5 * dy;
+        L.Kxyz += gm7 * dx * dy * dz;
+    }
+
+    /**
+     * @brief L2L: shifts the expansion of node n into its children, recursively.
+     */
+    void push(int n) {
+        const OctreeNode& node = nodes[n];
+        if (node.leaf) return;
+
+        const LocalExpansion& L = locals[n];
+        const bool spawn = node.count >= kTaskMin;
+        for (int c : node.child) {
+            if (c < 0 || nodes[c].m == 0) continue;
+            const OctreeNode& child = nodes[c];
+            real dx = child.cx - node.cx;
+            real dy = child.cy - node.cy;
+            real dz = child.cz - node.cz;
+
+            LocalExpansion& C = locals[c];
+            const real xx = real(0.5) * dx * dx, yy = real(0.5) * dy * dy, zz = real(0.5) * dz * dz;
+            const real xy = dx * dy, xz = dx * dz, yz = dy * dz;
+            C.ax += L.ax + L.Jxx * dx + L.Jxy * dy + L.Jxz * dz
+                  + L.Kxxx * xx + L.Kxyy * yy + L.Kxzz * zz + L.Kxxy * xy + L.Kxxz * xz + L.Kxyz * yz;
+            C.ay += L.ay + L.Jxy * dx + L.Jyy * dy + L.Jyz * dz
+                  + L.Kxxy * xx + L.Kyyy * yy + L.Kyzz * zz + L.Kxyy * xy + L.Kxyz * xz + L.Kyyz * yz;
+            C.az += L.az + L.Jxz * dx + L.Jyz * dy + L.Jzz * dz
+                  + L.Kxxz * xx + L.Kyyz * yy + L.Kzzz * zz + L.Kxyz * xy + L.Kxzz * xz + L.Kyzz * yz;
+            C.Jxx += L.Jxx + L.Kxxx * dx + L.Kxxy * dy + L.Kxxz * dz;
+            C.Jyy += L.Jyy + L.Kxyy * dx + L.Kyyy * dy + L.Kyyz * dz;
+            C.Jzz += L.Jzz + L.Kxzz * dx + L.Kyzz * dy + L.Kzzz * dz;
+            C.Jxy += L.Jxy + L.Kxxy * dx + L.Kxyy * dy + L.Kxyz * dz;
+            C.Jxz += L.Jxz + L.Kxxz * dx + L.Kxyz * dy + L.Kxzz * dz;
+            C.Jyz += L.Jyz + L.Kxyz * dx + L.Kyyz * dy + L.Kyzz * dz;
+            C.Kxxx += L.Kxxx; C.Kyyy += L.Kyyy; C.Kzzz += L.Kzzz;
+            C.Kxxy += L.Kxxy; C.Kxxz += L.Kxxz; C.Kxyy += L.Kxyy;
+            C.Kyyz += L.Kyyz; C.Kxzz += L.Kxzz; C.Kyzz += L.Kyzz; C.Kxyz += L.Kxyz;
+            work[c] = work[c] / real(std::max(child.count, 1)) + work[n];
+
+            #pragma omp task if(spawn) firstprivate(c)
+            push(c);
+        }
+        #pragma omp taskwait
+    }
+};
@@ -0,0 +1,251 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "kernels.h"
+#include "octree.h"
+#include "struct/particle.h"
+#include "util/profile.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <omp.h>
+
+/**
+ * @brief Interaction list in SoA layout, shared by all targets of one group.
+ * The softening terms that only depend on the source are precomputed when an entry is
+ * added, which keeps cbrt/pow out of the evaluation loops. Positions are stored relative
+ * to an origin (the group center), so the list can use the force precision 'treal'.
+ */
+struct InteractionList {
+    std::vector<treal> x, y, z, m;
+    std::vector<treal> epsBase;  // size*0.015 + cbrt(m)*0.002, tapered per target as in nextSoftening
+    std::vector<treal> epsDM;    // 2*size/cbrt(m); times cbrt(m_target) gives the DM softening floor
+    std::vector<treal> Qxx, Qyy, Qzz, Qxy, Qxz, Qyz;
+
+    size_t size() const { return x.size(); }
+
+    void clear() {
+        x.clear(); y.clear(); z.clear(); m.clear();
+        epsBase.clear(); epsDM.clear();
+        Qxx.clear(); Qyy.clear(); Qzz.clear(); Qxy.clear(); Qxz.clear(); Qyz.clear();
+    }
+
+    void add(const OctreeNode& n, bool quadrupole, real ox, real oy, real oz) {
+        treal cm = std::cbrt(n.m);
+        x.push_back(treal(n.cx - ox)); y.push_back(treal(n.cy - oy)); z.push_back(treal(n.cz - oz));
+        m.push_back(n.m);
+        epsBase.push_back(n.size * treal(0.015) + cm * treal(0.002));
+        epsDM.push_back(treal(2.0) * n.size / cm);
+        if (!quadrupole) return;
+        Qxx.push_back(n.Qxx); Qyy.push_back(n.Qyy); Qzz.push_back(n.Qzz);
+        Qxy.push_back(n.Qxy); Qxz.push_back(n.Qxz); Qyz.push_back(n.Qyz);
+    }
+
+    /**
+     * @brief Pads the list with massless entries to a multiple of kSimdPad and returns a kernel view.
+     */
+    ListView finish(bool quadrupole) {
+        while (x.size() % kSimdPad != 0) {
+            x.push_back(0); y.push_back(0); z.push_back(0); m.push_back(0);
+            epsBase.push_back(0); epsDM.push_back(0);
+            if (!quadrupole) continue;
+            Qxx.push_back(0); Qyy.push_back(0); Qzz.push_back(0);
+            Qxy.push_back(0); Qxz.push_back(0); Qyz.push_back(0);
+        }
+        return ListView{ x.data(), y.data(), z.data(), m.data(), epsBase.data(), epsDM.data(),
+                         Qxx.data(), Qyy.data(), Qzz.data(), Qxy.data(), Qxz.data(), Qyz.data(),
+                         static_cast<int>(x.size()) };
+    }
+};
+
+/**
+ * @brief True if the node carries a quadrupole moment. Leaves holding one particle never do.
+ */
+inline bool hasQuadrupole(const OctreeNode& n) {
+    return n.Qxx != 0 || n.Qyy != 0 || n.Qzz != 0 || n.Qxy != 0 || n.Qxz != 0 || n.Qyz != 0;
+}
+
+/**
+ * @brief Barnes-Hut acceleration on target 'i' with the SIMD kernels picked for this CPU.
+ * The same opening test and softening as bhAccelNode, but the accepted cells and the reached
+ * leaves are first gathered into lists centered on the target (pc and pp, reused between calls)
+ * and then summed in one kernel call each. Returns the number of interactions.
+ */
+inline int listAccel(const Octree& tree, int i, const ParticleSystem& ps, real theta, InteractionList& pp,
+                     InteractionList& pc, std::vector<int>& stack, real& ax, real& ay, real& az) {
+    if (tree.empty()) return 0;
+    const OctreeNode* nodes = tree.nodes.data();
+    const real px = ps.x[i], py = ps.y[i], pz = ps.z[i];
+
+    pp.clear();
+    pc.clear();
+    stack.assign(1, 0);
+    while (!stack.empty()) {
+        const int n = stack.back();
+        stack.pop_back();
+        const OctreeNode& node = nodes[n];
+        if (node.m == 0) continue;
+        if (node.leaf) {
+            if (node.bodyIdx == i) continue;
+            // Ghost leaves imported from other ranks may stand for a whole node (see parallel/domain.h)
+            if (hasQuadrupole(node)) pc.add(node, true, px, py, pz);
+            else pp.add(node, false, px, py, pz);
+            continue;
+        }
+
+        const treal dx = treal(node.cx - px), dy = treal(node.cy - py), dz = treal(node.cz - pz);
+        const treal dist = std::sqrt(dx*dx + dy*dy + dz*dz + treal(1e-20));
+        if (node.size < theta * dist) { pc.add(node, true, px, py, pz); continue; }
+
+        for (int c : node.child) {
+            if (c >= 0) stack.push_back(c);
+        }
+    }
+
+    const int interactions = static_cast<int>(pc.size() + pp.size());
+    const ForceKernels& kernels = forceKernels();
+    const treal dmScale = (ps.type[i] == 1) ? treal(std::cbrt(ps.m[i])) : treal(0);
+    treal acc[3] = { 0, 0, 0 };
+    kernels.cell(pc.finish(true), 0, 0, 0, dmScale, acc);
+    kernels.particle(pp.finish(false), 0, 0, 0, dmScale, acc);
+    ax = acc[0]; ay = acc[1]; az = acc[2];
+    return interactions;
+}
+
+/**
+ * @brief Splits the tree into target groups: the highest nodes holding at most groupSize particles.
+ */
+inline void collectGroups(const Octree& tree, int groupSize, std::vector<int>& groups) {
+    groups.clear();
+    if (tree.empty()) return;
+
+    std::vector<int> stack{0};
+    while (!stack.empty()) {
+        const int n = stack.back();
+        stack.pop_back();
+        const OctreeNode& node = tree.nodes[n];
+        if (node.count == 0) continue;
+        if (node.leaf || node.count <= groupSize) { groups.push_back(n); continue; }
+        for (int c : node.child) {
+            if (c >= 0) stack.push_back(c);
+        }
+    }
+}
+
+/**
+ * @brief Group-based Barnes-Hut walk. Writes ps.ax/ay/az for the targets in [start, end)
+ * (restricted to active[i] != 0 if 'active' is given), and the interaction count of every
+ * target to ps.cost if that lane is sized. If 'threadBusy' is given, thread t adds the time it
+ * spent working to threadBusy[t].
+ * Each group of nearby targets walks the tree once with a conservative opening criterion:
+ * a cell is accepted only if size / (distance - groupRadius) < theta, so it would be accepted
+ * by every target of the group. Accepted cells go to the particle-cell list, reached leaves to
+ * the particle-particle list, and both lists are then evaluated for every target with the
+ * SIMD kernels picked for this CPU (see kernels.h).
+ */
+inline void groupAccel(const Octree& tree, ParticleSystem& ps, real theta, int groupSize, int start, int end,
+                       const std::vector<unsigned char>* active = nullptr, double* threadBusy = nullptr) {
+    if (tree.empty()) return;
+
+    std::vector<int> groups;
+    collectGroups(tree, groupSize, groups);
+    const OctreeNode* nodes = tree.nodes.data();
+    const int G = static_cast<int>(groups.size());
+    const ForceKernels& kernels = forceKernels();
+    const bool recordCost = static_cast<int>(ps.cost.size()) >= end;
+
+    #pragma omp parallel
+    {
+        NEXT_PROFILE_SCOPE("force.thread");
+        InteractionList pp, pc;
+        std::vector<int> stack, targets;
+        const double t0 = omp_get_wtime();
+
+        #pragma omp for schedule(dynamic, 1) nowait
+        for (int g = 0; g < G; ++g) {
+            // Targets of this group: all bodies below the group node that this rank owns
+            targets.clear();
+            stack.assign(1, groups[g]);
+            while (!stack.empty()) {
+                const OctreeNode& node = nodes[stack.back()];
+                stack.pop_back();
+                if (node.leaf) {
+                    const int b = node.bodyIdx;
+                    if (b >= start && b < end && (!active || (*active)[b])) targets.push_back(b);
+                    continue;
+                }
+                for (int c : node.child) {
+                    if (c >= 0) stack.push_back(c);
+                }
+            }
+            if (targets.empty()) continue;
+
+            // Bounding sphere of the targets
+            real minx = ps.x[targets[0]], maxx = minx;
+            real miny = ps.y[targets[0]], maxy = miny;
+            real minz = ps.z[targets[0]], maxz = minz;
+            for (int i : targets) {
+                minx = std::min(minx, ps.x[i]); maxx = std::max(maxx, ps.x[i]);
+                miny = std::min(miny, ps.y[i]); maxy = std::max(maxy, ps.y[i]);
+                minz = std::min(minz, ps.z[i]); maxz = std::max(maxz, ps.z[i]);
+            }
+            const real gx = (minx + maxx) * real(0.5);
+            const real gy = (miny + maxy) * real(0.5);
+            const real gz = (minz + maxz) * real(0.5);
+            real R2 = 0;
+            for (int i : targets) {
+                real dx = ps.x[i] - gx, dy = ps.y[i] - gy, dz = ps.z[i] - gz;
+                R2 = std::max(R2, dx*dx + dy*dy + dz*dz);
+            }
+            const real R = std::sqrt(R2);
+
+            // One traversal for the whole group
+            pp.clear();
+            pc.clear();
+            stack.assign(1, 0);
+            while (!stack.empty()) {
+                const OctreeNode& node = nodes[stack.back()];
+                stack.pop_back();
+                if (node.m == 0) continue;
+                if (node.leaf) {
+                    // Ghost leaves imported from other ranks may stand for a whole node (see parallel/domain.h)
+                    if (hasQuadrupole(node)) pc.add(node, true, gx, gy, gz);
+                    else pp.add(node, false, gx, gy, gz);
+                    continue;
+                }
+
+                real dx = node.cx - gx, dy = node.cy - gy, dz = node.cz - gz;
+                real d = std::sqrt(dx*dx + dy*dy + dz*dz) - R;
+                if (d > 0 && node.size < theta * d) { pc.add(node, true, gx, gy, gz); continue; }
+
+                for (int c : node.child) {
+                    if (c >= 0) stack.push_back(c);
+                }
+            }
+
+            const ListView cells = pc.finish(true);
+            const ListView leaves = pp.finish(false);
+            for (int i : targets) {
+                const treal dmScale = (ps.type[i] == 1) ? treal(std::cbrt(ps.m[i])) : treal(0);
+                const treal px = treal(ps.x[i] - gx), py = treal(ps.y[i] - gy), pz = treal(ps.z[i] - gz);
+                treal acc[3] = { 0, 0, 0 };
+                kernels.cell(cells, px, py, pz, dmScale, acc);
+                kernels.particle(leaves, px, py, pz, dmScale, acc);
+                ps.ax[i] = acc[0]; ps.ay[i] = acc[1]; ps.az[i] = acc[2];
+                if (recordCost) ps.cost[i] = real(cells.n + leaves.n);
+            }
+        }
+
+        if (threadBusy) threadBusy[omp_get_thread_num()] += omp_get_wtime() - t0;
+    }
+}
@@ -0,0 +1,151 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#if defined(NEXT_SIMD_X86) && defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+#endif
+
+/**
+ * @brief Scalar monopole + quadrupole kernel. Same math as bhAccel, with the
+ * source-only softening terms precomputed in the list.
+ */
+void cellListScalar(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    treal sx = 0, sy = 0, sz = 0;
+    for (int k = 0; k < L.n; ++k) {
+        treal dx = L.x[k] - px, dy = L.y[k] - py, dz = L.z[k] - pz;
+        treal r2 = dx*dx + dy*dy + dz*dz;
+        treal dist = std::sqrt(r2 + treal(1e-20));
+        treal eps = std::max(L.epsBase[k] / (treal(1.0) + dist * treal(10.0)), treal(1e-4));
+        eps = std::max(eps, L.epsDM[k] * dmScale);
+
+        treal dist_inv = treal(1.0) / std::sqrt(r2 + eps*eps);
+        treal inv2 = dist_inv * dist_inv;
+        treal inv3 = dist_inv * inv2;
+        treal inv5 = inv3 * inv2;
+        treal inv7 = inv5 * inv2;
+        treal fac = L.m[k] * inv3;
+
+        treal q = L.Qxx[k]*dx*dx + L.Qyy[k]*dy*dy + L.Qzz[k]*dz*dz +
+                 2*(L.Qxy[k]*dx*dy + L.Qxz[k]*dx*dz + L.Qyz[k]*dy*dz);
+        treal Qrx = 2*(L.Qxx[k]*dx + L.Qxy[k]*dy + L.Qxz[k]*dz);
+        treal Qry = 2*(L.Qxy[k]*dx + L.Qyy[k]*dy + L.Qyz[k]*dz);
+        treal Qrz = 2*(L.Qxz[k]*dx + L.Qyz[k]*dy + L.Qzz[k]*dz);
+
+        sx += dx * fac + treal(0.5) * (Qrx * inv5 - 5 * q * inv7 * dx);
+        sy += dy * fac + treal(0.5) * (Qry * inv5 - 5 * q * inv7 * dy);
+        sz += dz * fac + treal(0.5) * (Qrz * inv5 - 5 * q * inv7 * dz);
+    }
+    acc[0] += sx; acc[1] += sy; acc[2] += sz;
+}
+
+/**
+ * @brief Scalar monopole kernel for particle-particle lists.
+ */
+void particleListScalar(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    treal sx = 0, sy = 0, sz = 0;
+    for (int k = 0; k < L.n; ++k) {
+        treal dx = L.x[k] - px, dy = L.y[k] - py, dz = L.z[k] - pz;
+        treal r2 = dx*dx + dy*dy + dz*dz;
+        treal dist = std::sqrt(r2 + treal(1e-20));
+        treal eps = std::max(L.epsBase[k] / (treal(1.0) + dist * treal(10.0)), treal(1e-4));
+        eps = std::max(eps, L.epsDM[k] * dmScale);
+
+        treal dist_inv = treal(1.0) / std::sqrt(r2 + eps*eps);
+        treal fac = L.m[k] * dist_inv * dist_inv * dist_inv;
+        sx += dx * fac; sy += dy * fac; sz += dz * fac;
+    }
+    acc[0] += sx; acc[1] += sy; acc[2] += sz;
+}
+
+/**
+ * @brief Scalar direct-summation kernel: pairSoftening() of target and source, monopole only.
+ */
+void pairBlockScalar(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc) {
+    treal sx = 0, sy = 0, sz = 0;
+    for (int k = 0; k < J.n; ++k) {
+        treal dx = J.x[k] - px, dy = J.y[k] - py, dz = J.z[k] - pz;
+        treal r2 = dx*dx + dy*dy + dz*dz;
+        treal eps2 = std::max(J.e2[k] + e2, treal(1e-8));
+
+        treal dist_inv = treal(1.0) / std::sqrt(r2 + eps2);
+        treal fac = J.m[k] * dist_inv * dist_inv * dist_inv;
+        sx += dx * fac; sy += dy * fac; sz += dz * fac;
+    }
+    acc[0] += sx; acc[1] += sy; acc[2] += sz;
+}
+
+namespace {
+
+enum class Isa { Scalar = 0, SSE = 1, AVX2 = 2, AVX512 = 3 };
+
+Isa detectIsa() {
+#if !defined(NEXT_SIMD_X86)
+    return Isa::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    const int maxLeaf = r[0];
+    __cpuid(r, 1);
+    const bool osxsave = (r[2] & (1 << 27)) != 0;
+    const bool fma     = (r[2] & (1 << 12)) != 0;
+    bool avx2 = false, avx512f = false;
+    if (maxLeaf >= 7) {
+        __cpuidex(r, 7, 0);
+        avx2    = (r[1] & (1 << 5)) != 0;
+        avx512f = (r[1] & (1 << 16)) != 0;
+    }
+    // The OS must also save the YMM/ZMM state on context switches
+    const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    if (avx512f && (xcr0 & 0xe6) == 0xe6) return Isa::AVX512;
+    if (avx2 && fma && (xcr0 & 0x6) == 0x6) return Isa::AVX2;
+    return Isa::SSE;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return Isa::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return Isa::AVX2;
+    return Isa::SSE;
+#endif
+}
+
+ForceKernels selectKernels() {
+    Isa isa = detectIsa();
+
+    if (const char* env = std::getenv("NEXT_SIMD")) {
+        const std::string req = env;
+        Isa wanted = isa;
+        if (req == "scalar") wanted = Isa::Scalar;
+        else if (req == "sse") wanted = Isa::SSE;
+        else if (req == "avx2") wanted = Isa::AVX2;
+        else if (req == "avx512") wanted = Isa::AVX512;
+        isa = std::min(isa, wanted);
+    }
+
+    switch (isa) {
+#ifdef NEXT_SIMD_X86
+        case Isa::AVX512: return { cellListAVX512, particleListAVX512, pairBlockAVX512, "AVX-512" };
+        case Isa::AVX2:   return { cellListAVX2, particleListAVX2, pairBlockAVX2, "AVX2" };
+        case Isa::SSE:    return { cellListSSE, particleListSSE, pairBlockSSE, "SSE2" };
+#endif
+        default:          return { cellListScalar, particleListScalar, pairBlockScalar, "scalar" };
+    }
+}
+
+} // namespace
+
+const ForceKernels& forceKernels() {
+    static const ForceKernels kernels = selectKernels();
+    return kernels;
+}
@@ -0,0 +1,86 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+
+// Lists handed to the kernels are padded with massless entries to a multiple of this
+// many elements, so every SIMD width can run without a remainder loop.
+constexpr int kSimdPad = 16;
+
+/**
+ * @brief Raw view of an interaction list (SoA, padded to kSimdPad).
+ * Positions are relative to the center of the target group, so they stay small enough for
+ * the force precision 'treal' even when the particle state is kept in FP64 (NEXT_MIXED).
+ * Kept free of std:: types on purpose: the ISA-specific translation units are compiled
+ * with -mavx2 / -mavx512f and must not emit inline library code the rest of NEXT could pick up.
+ */
+struct ListView {
+    const treal *x, *y, *z, *m;
+    const treal *epsBase, *epsDM;
+    const treal *Qxx, *Qyy, *Qzz, *Qxy, *Qxz, *Qyz;
+    int n;
+};
+
+/**
+ * @brief Sums the acceleration of all list entries on one target into acc[0..2].
+ * (px, py, pz) is the target position in the frame of the list.
+ * dmScale is cbrt(m_target) for Dark Matter targets and 0 otherwise.
+ */
+using ListKernel = void (*)(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+
+/**
+ * @brief Raw view of a block of source particles for direct summation (SoA, padded to kSimdPad).
+ * Positions are relative to an origin near the targets, as for ListView. e2 is the source's
+ * share of the squared pair softening (see pairSoftening).
+ */
+struct PairView {
+    const treal *x, *y, *z, *m, *e2;
+    int n;
+};
+
+/**
+ * @brief Sums the acceleration of all sources in the block on one target into acc[0..2].
+ * e2 is the target's share of the squared pair softening. A source at the target's own
+ * position contributes nothing, so a target may be part of the block.
+ */
+using PairKernel = void (*)(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc);
+
+struct ForceKernels {
+    ListKernel cell;       // Monopole + quadrupole (particle-cell list)
+    ListKernel particle;   // Monopole only (particle-particle list)
+    PairKernel pair;       // Direct summation with the pair softening
+    const char* name;
+};
+
+/**
+ * @brief Kernels for this CPU, chosen once from CPUID.
+ * Setting NEXT_SIMD=scalar|sse|avx2|avx512 in the environment overrides the choice
+ * (an unsupported request falls back to the best supported set).
+ */
+const ForceKernels& forceKernels();
+
+// Scalar reference kernels (kernels.cpp)
+void cellListScalar(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void particleListScalar(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void pairBlockScalar(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc);
+
+#ifdef NEXT_SIMD_X86
+void cellListSSE(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void particleListSSE(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void pairBlockSSE(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc);
+void cellListAVX2(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void particleListAVX2(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void pairBlockAVX2(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc);
+void cellListAVX512(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void particleListAVX512(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc);
+void pairBlockAVX512(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc);
+#endif
@@ -0,0 +1,74 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// AVX2 + FMA force kernels. CMake compiles this file with -mavx2 -mfma (/arch:AVX2).
+#include "kernels_simd.h"
+
+#ifdef NEXT_SIMD_X86
+#include <immintrin.h>
+
+namespace {
+
+#if defined(NEXT_FP32) || defined(NEXT_MIXED)
+struct V {
+    using T = __m256;
+    static constexpr int W = 8;
+    static T load(const treal* p) { return _mm256_loadu_ps(p); }
+    static T set1(treal v) { return _mm256_set1_ps(v); }
+    static T add(T a, T b) { return _mm256_add_ps(a, b); }
+    static T sub(T a, T b) { return _mm256_sub_ps(a, b); }
+    static T mul(T a, T b) { return _mm256_mul_ps(a, b); }
+    static T div(T a, T b) { return _mm256_div_ps(a, b); }
+    static T max(T a, T b) { return _mm256_max_ps(a, b); }
+    static T sqrt(T a) { return _mm256_sqrt_ps(a); }
+    static T fmadd(T a, T b, T c) { return _mm256_fmadd_ps(a, b, c); }
+    static treal hsum(T a) {
+        alignas(32) float t[8];
+        _mm256_store_ps(t, a);
+        return ((t[0] + t[1]) + (t[2] + t[3])) + ((t[4] + t[5]) + (t[6] + t[7]));
+    }
+};
+#else
+struct V {
+    using T = __m256d;
+    static constexpr int W = 4;
+    static T load(const treal* p) { return _mm256_loadu_pd(p); }
+    static T set1(treal v) { return _mm256_set1_pd(v); }
+    static T add(T a, T b) { return _mm256_add_pd(a, b); }
+    static T sub(T a, T b) { return _mm256_sub_pd(a, b); }
+    static T mul(T a, T b) { return _mm256_mul_pd(a, b); }
+    static T div(T a, T b) { return _mm256_div_pd(a, b); }
+    static T max(T a, T b) { return _mm256_max_pd(a, b); }
+    static T sqrt(T a) { return _mm256_sqrt_pd(a); }
+    static T fmadd(T a, T b, T c) { return _mm256_fmadd_pd(a, b, c); }
+    static treal hsum(T a) {
+        alignas(32) double t[4];
+        _mm256_store_pd(t, a);
+        return (t[0] + t[1]) + (t[2] + t[3]);
+    }
+};
+#endif
+
+} // namespace
+
+void cellListAVX2(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, true>(L, px, py, pz, dmScale, acc);
+}
+
+void particleListAVX2(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, false>(L, px, py, pz, dmScale, acc);
+}
+
+void pairBlockAVX2(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc) {
+    pairKernel<V>(J, px, py, pz, e2, acc);
+}
+
+#endif // NEXT_SIMD_X86
@@ -0,0 +1,70 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// AVX-512F force kernels. CMake compiles this file with -mavx512f (/arch:AVX512).
+#include "kernels_simd.h"
+
+#ifdef NEXT_SIMD_X86
+#include <immintrin.h>
+
+namespace {
+
+#if defined(NEXT_FP32) || defined(NEXT_MIXED)
+struct V {
+    using T = __m512;
+    static constexpr int W = 16;
+    static T load(const treal* p) { return _mm512_loadu_ps(p); }
+    static T set1(treal v) { return _mm512_set1_ps(v); }
+    static T add(T a, T b) { return _mm512_add_ps(a, b); }
+    static T sub(T a, T b) { return _mm512_sub_ps(a, b); }
+    static T mul(T a, T b) { return _mm512_mul_ps(a, b); }
+    static T div(T a, T b) { return _mm512_div_ps(a, b); }
+    static T max(T a, T b) { return _mm512_max_ps(a, b); }
+    static T sqrt(T a) { return _mm512_sqrt_ps(a); }
+    static T fmadd(T a, T b, T c) { return _mm512_fmadd_ps(a, b, c); }
+    static treal hsum(T a) {
+        return _mm512_reduce_add_ps(a);
+    }
+};
+#else
+struct V {
+    using T = __m512d;
+    static constexpr int W = 8;
+    static T load(const treal* p) { return _mm512_loadu_pd(p); }
+    static T set1(treal v) { return _mm512_set1_pd(v); }
+    static T add(T a, T b) { return _mm512_add_pd(a, b); }
+    static T sub(T a, T b) { return _mm512_sub_pd(a, b); }
+    static T mul(T a, T b) { return _mm512_mul_pd(a, b); }
+    static T div(T a, T b) { return _mm512_div_pd(a, b); }
+    static T max(T a, T b) { return _mm512_max_pd(a, b); }
+    static T sqrt(T a) { return _mm512_sqrt_pd(a); }
+    static T fmadd(T a, T b, T c) { return _mm512_fmadd_pd(a, b, c); }
+    static treal hsum(T a) {
+        return _mm512_reduce_add_pd(a);
+    }
+};
+#endif
+
+} // namespace
+
+void cellListAVX512(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, true>(L, px, py, pz, dmScale, acc);
+}
+
+void particleListAVX512(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, false>(L, px, py, pz, dmScale, acc);
+}
+
+void pairBlockAVX512(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc) {
+    pairKernel<V>(J, px, py, pz, e2, acc);
+}
+
+#endif // NEXT_SIMD_X86
@@ -0,0 +1,103 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Shared body of the explicit SIMD kernels. Only included by the kernels_<isa>.cpp files,
+// each of which defines a vector type V (width V::W, element type 'treal') in an anonymous
+// namespace, so every instantiation stays local to its translation unit.
+#pragma once
+#include "kernels.h"
+
+/**
+ * @brief Monopole (+ quadrupole if Quad) sum over a padded list, same math as bhAccel.
+ */
+template <class V, bool Quad>
+inline void listKernel(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    using T = typename V::T;
+    const T vpx = V::set1(px), vpy = V::set1(py), vpz = V::set1(pz);
+    const T vdm = V::set1(dmScale);
+    const T tiny = V::set1(treal(1e-20)), one = V::set1(treal(1.0)), ten = V::set1(treal(10.0));
+    const T floor = V::set1(treal(1e-4)), two = V::set1(treal(2.0)), five = V::set1(treal(5.0));
+    const T half = V::set1(treal(0.5));
+
+    T sx = V::set1(0), sy = V::set1(0), sz = V::set1(0);
+    for (int k = 0; k < L.n; k += V::W) {
+        T dx = V::sub(V::load(L.x + k), vpx);
+        T dy = V::sub(V::load(L.y + k), vpy);
+        T dz = V::sub(V::load(L.z + k), vpz);
+        T r2 = V::fmadd(dx, dx, V::fmadd(dy, dy, V::mul(dz, dz)));
+
+        // Softening: tapered node term with floor, then the DM floor (zero for stars)
+        T dist = V::sqrt(V::add(r2, tiny));
+        T eps = V::max(V::div(V::load(L.epsBase + k), V::fmadd(dist, ten, one)), floor);
+        eps = V::max(eps, V::mul(V::load(L.epsDM + k), vdm));
+
+        T dinv = V::div(one, V::sqrt(V::fmadd(eps, eps, r2)));
+        T inv2 = V::mul(dinv, dinv);
+        T inv3 = V::mul(dinv, inv2);
+        T fac = V::mul(V::load(L.m + k), inv3);
+
+        T fx = V::mul(dx, fac), fy = V::mul(dy, fac), fz = V::mul(dz, fac);
+
+        if (Quad) {
+            const T qxx = V::load(L.Qxx + k), qyy = V::load(L.Qyy + k), qzz = V::load(L.Qzz + k);
+            const T qxy = V::load(L.Qxy + k), qxz = V::load(L.Qxz + k), qyz = V::load(L.Qyz + k);
+            T inv5 = V::mul(inv3, inv2);
+            T inv7 = V::mul(inv5, inv2);
+
+            T q = V::fmadd(V::mul(qxx, dx), dx, V::fmadd(V::mul(qyy, dy), dy, V::mul(V::mul(qzz, dz), dz)));
+            T qc = V::fmadd(V::mul(qxy, dx), dy, V::fmadd(V::mul(qxz, dx), dz, V::mul(V::mul(qyz, dy), dz)));
+            q = V::fmadd(two, qc, q);
+
+            T Qrx = V::mul(two, V::fmadd(qxx, dx, V::fmadd(qxy, dy, V::mul(qxz, dz))));
+            T Qry = V::mul(two, V::fmadd(qxy, dx, V::fmadd(qyy, dy, V::mul(qyz, dz))));
+            T Qrz = V::mul(two, V::fmadd(qxz, dx, V::fmadd(qyz, dy, V::mul(qzz, dz))));
+
+            T s = V::mul(V::mul(five, q), inv7);
+            fx = V::fmadd(half, V::sub(V::mul(Qrx, inv5), V::mul(s, dx)), fx);
+            fy = V::fmadd(half, V::sub(V::mul(Qry, inv5), V::mul(s, dy)), fy);
+            fz = V::fmadd(half, V::sub(V::mul(Qrz, inv5), V::mul(s, dz)), fz);
+        }
+
+        sx = V::add(sx, fx); sy = V::add(sy, fy); sz = V::add(sz, fz);
+    }
+
+    acc[0] += V::hsum(sx);
+    acc[1] += V::hsum(sy);
+    acc[2] += V::hsum(sz);
+}
+
+/**
+ * @brief Direct-summation sum over a padded source block, same math as pairSoftening + GravitySoA.
+ */
+template <class V>
+inline void pairKernel(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc) {
+    using T = typename V::T;
+    const T vpx = V::set1(px), vpy = V::set1(py), vpz = V::set1(pz);
+    const T ve2 = V::set1(e2), floor2 = V::set1(treal(1e-8)), one = V::set1(treal(1.0));
+
+    T sx = V::set1(0), sy = V::set1(0), sz = V::set1(0);
+    for (int k = 0; k < J.n; k += V::W) {
+        T dx = V::sub(V::load(J.x + k), vpx);
+        T dy = V::sub(V::load(J.y + k), vpy);
+        T dz = V::sub(V::load(J.z + k), vpz);
+        T r2 = V::fmadd(dx, dx, V::fmadd(dy, dy, V::mul(dz, dz)));
+
+        T eps2 = V::max(V::add(V::load(J.e2 + k), ve2), floor2);
+        T dinv = V::div(one, V::sqrt(V::add(r2, eps2)));
+        T fac = V::mul(V::load(J.m + k), V::mul(dinv, V::mul(dinv, dinv)));
+
+        sx = V::fmadd(dx, fac, sx); sy = V::fmadd(dy, fac, sy); sz = V::fmadd(dz, fac, sz);
+    }
+
+    acc[0] += V::hsum(sx);
+    acc[1] += V::hsum(sy);
+    acc[2] += V::hsum(sz);
+}
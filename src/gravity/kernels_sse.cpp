@@ -0,0 +1,74 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// SSE2 force kernels (baseline on every x86-64 CPU, no extra compiler flags).
+#include "kernels_simd.h"
+
+#ifdef NEXT_SIMD_X86
+#include <immintrin.h>
+
+namespace {
+
+#if defined(NEXT_FP32) || defined(NEXT_MIXED)
+struct V {
+    using T = __m128;
+    static constexpr int W = 4;
+    static T load(const treal* p) { return _mm_loadu_ps(p); }
+    static T set1(treal v) { return _mm_set1_ps(v); }
+    static T add(T a, T b) { return _mm_add_ps(a, b); }
+    static T sub(T a, T b) { return _mm_sub_ps(a, b); }
+    static T mul(T a, T b) { return _mm_mul_ps(a, b); }
+    static T div(T a, T b) { return _mm_div_ps(a, b); }
+    static T max(T a, T b) { return _mm_max_ps(a, b); }
+    static T sqrt(T a) { return _mm_sqrt_ps(a); }
+    static T fmadd(T a, T b, T c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static treal hsum(T a) {
+        alignas(16) float t[4];
+        _mm_store_ps(t, a);
+        return (t[0] + t[1]) + (t[2] + t[3]);
+    }
+};
+#else
+struct V {
+    using T = __m128d;
+    static constexpr int W = 2;
+    static T load(const treal* p) { return _mm_loadu_pd(p); }
+    static T set1(treal v) { return _mm_set1_pd(v); }
+    static T add(T a, T b) { return _mm_add_pd(a, b); }
+    static T sub(T a, T b) { return _mm_sub_pd(a, b); }
+    static T mul(T a, T b) { return _mm_mul_pd(a, b); }
+    static T div(T a, T b) { return _mm_div_pd(a, b); }
+    static T max(T a, T b) { return _mm_max_pd(a, b); }
+    static T sqrt(T a) { return _mm_sqrt_pd(a); }
+    static T fmadd(T a, T b, T c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+    static treal hsum(T a) {
+        alignas(16) double t[2];
+        _mm_store_pd(t, a);
+        return t[0] + t[1];
+    }
+};
+#endif
+
+} // namespace
+
+void cellListSSE(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, true>(L, px, py, pz, dmScale, acc);
+}
+
+void particleListSSE(const ListView& L, treal px, treal py, treal pz, treal dmScale, treal* acc) {
+    listKernel<V, false>(L, px, py, pz, dmScale, acc);
+}
+
+void pairBlockSSE(const PairView& J, treal px, treal py, treal pz, treal e2, treal* acc) {
+    pairKernel<V>(J, px, py, pz, e2, acc);
+}
+
+#endif // NEXT_SIMD_X86
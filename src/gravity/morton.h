@@ -0,0 +1,137 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "octree.h"
+#include "struct/particle.h"
+#include <vector>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <omp.h>
+
+/**
+ * @brief Spreads the lower 21 bits of v so that two zero bits separate each of them.
+ */
+inline uint64_t mortonSpread(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+/**
+ * @brief 63-bit Morton key. The bit order (x lowest) matches Octree::getOctant.
+ */
+inline uint64_t mortonKey(uint32_t ix, uint32_t iy, uint32_t iz) {
+    return mortonSpread(ix) | (mortonSpread(iy) << 1) | (mortonSpread(iz) << 2);
+}
+
+/**
+ * @brief Computes the Morton key of every particle on a 2^21 grid spanning the cube around 'box'.
+ */
+inline void computeMortonKeys(const ParticleSystem& ps, const BBox& box, std::vector<uint64_t>& keys) {
+    const int N = static_cast<int>(ps.size());
+    constexpr real cells = real((1u << 21) - 1);
+
+    real size = std::max({box.maxx - box.minx, box.maxy - box.miny, box.maxz - box.minz});
+    if (size <= real(0)) size = real(1.0);
+    const real scale = cells / size;
+
+    auto cell = [&](real v, real lo) -> uint32_t {
+        real c = (v - lo) * scale;
+        return static_cast<uint32_t>(std::min(std::max(c, real(0)), cells));
+    };
+
+    keys.resize(N);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < N; ++i)
+        keys[i] = mortonKey(cell(ps.x[i], box.minx), cell(ps.y[i], box.miny), cell(ps.z[i], box.minz));
+}
+
+/**
+ * @brief Stable LSD radix sort of 'keys' (8 bits per pass), returning the sorting permutation in 'order'.
+ * Each pass builds per-chunk histograms and scatters in parallel; passes whose digit is the same
+ * for every key are skipped.
+ */
+inline void radixSortKeys(std::vector<uint64_t>& keys, std::vector<int>& order) {
+    const int N = static_cast<int>(keys.size());
+    order.resize(N);
+    std::iota(order.begin(), order.end(), 0);
+    if (N < 2) return;
+
+    const int chunks = std::max(1, std::min(omp_get_max_threads(), N / 4096));
+    std::vector<size_t> hist(static_cast<size_t>(chunks) * 256);
+    std::vector<uint64_t> keysTmp(N);
+    std::vector<int> orderTmp(N);
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::fill(hist.begin(), hist.end(), 0);
+
+        #pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < chunks; ++c) {
+            const int begin = static_cast<int>((static_cast<long long>(N) * c) / chunks);
+            const int end   = static_cast<int>((static_cast<long long>(N) * (c + 1)) / chunks);
+            size_t* h = &hist[static_cast<size_t>(c) * 256];
+            for (int i = begin; i < end; ++i) h[(keys[i] >> shift) & 0xff]++;
+        }
+
+        // Exclusive prefix over (digit, chunk) turns counts into scatter offsets
+        bool trivial = false;
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t digitTotal = 0;
+            for (int c = 0; c < chunks; ++c) {
+                size_t& h = hist[static_cast<size_t>(c) * 256 + d];
+                digitTotal += h;
+                size_t count = h;
+                h = sum;
+                sum += count;
+            }
+            if (digitTotal == static_cast<size_t>(N)) trivial = true;
+        }
+        if (trivial) continue;
+
+        #pragma omp parallel for schedule(static, 1)
+        for (int c = 0; c < chunks; ++c) {
+            const int begin = static_cast<int>((static_cast<long long>(N) * c) / chunks);
+            const int end   = static_cast<int>((static_cast<long long>(N) * (c + 1)) / chunks);
+            size_t* h = &hist[static_cast<size_t>(c) * 256];
+            for (int i = begin; i < end; ++i) {
+                size_t dst = h[(keys[i] >> shift) & 0xff]++;
+                keysTmp[dst]  = keys[i];
+                orderTmp[dst] = order[i];
+            }
+        }
+
+        keys.swap(keysTmp);
+        order.swap(orderTmp);
+    }
+}
+
+/**
+ * @brief Sorts all particle lanes along a Morton curve.
+ * Particles that are close in space end up close in memory, which keeps neighbouring
+ * iterations of the force loop on the same tree branches and cache lines.
+ */
+inline void reorderParticles(ParticleSystem& ps) {
+    if (ps.size() < 2) return;
+
+    std::vector<uint64_t> keys;
+    std::vector<int> order;
+    computeMortonKeys(ps, computeBounds(ps), keys);
+    radixSortKeys(keys, order);
+    ps.permute(order);
+}
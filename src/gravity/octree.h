@@ -11,37 +11,65 @@
 
 #pragma once
 #include "struct/particle.h"
+#include "util/profile.h"
 #include "floatdef.h"
 #include "dt/softening.h"
 #include <vector>
 #include <cmath>
-#include <memory>
 #include <algorithm>
+#include <omp.h>
 
 /**
- * @brief Octree node structure redesigned for Structure of Arrays (SoA).
- * Instead of storing Particle pointers, it stores indices into the ParticleSystem.
+ * @brief Axis-aligned bounding box of a particle set.
  */
-struct Octree {
+struct BBox { real minx, miny, minz, maxx, maxy, maxz; };
+
+/**
+ * @brief Bounding box of the particles held by this process (parallel reduction).
+ */
+inline BBox computeBounds(const ParticleSystem& ps) {
+    const int N = static_cast<int>(ps.size());
+    real minx = real(1e30), miny = real(1e30), minz = real(1e30);
+    real maxx = real(-1e30), maxy = real(-1e30), maxz = real(-1e30);
+
+    #pragma omp parallel for schedule(static) reduction(min: minx, miny, minz) reduction(max: maxx, maxy, maxz)
+    for (int i = 0; i < N; ++i) {
+        minx = std::min(minx, ps.x[i]);
+        miny = std::min(miny, ps.y[i]);
+        minz = std::min(minz, ps.z[i]);
+        maxx = std::max(maxx, ps.x[i]);
+        maxy = std::max(maxy, ps.y[i]);
+        maxz = std::max(maxz, ps.z[i]);
+    }
+    return BBox{ minx, miny, minz, maxx, maxy, maxz };
+}
+
+/**
+ * @brief A single node of the linear octree.
+ * The fields read by the force walk come first so that one node visit touches
+ * as few cache lines as possible; the geometric center is only used while building.
+ * Positions and the cell geometry use the state precision 'real', the moments and the
+ * opening radius the force precision 'treal' (FP32 in NEXT_MIXED builds).
+ */
+struct OctreeNode {
     real cx, cy, cz;     // Center of Mass
-    real m;              // Total Mass
-    real x, y, z;        // Geometric center of node
-    real size;           // Half-width of node
-    bool leaf = true;
-    
-    // Index of the particle in the ParticleSystem. -1 means empty.
-    int bodyIdx = -1; 
-    
-    // Ownership: unique_ptr handles memory automatically
-    std::unique_ptr<Octree> child[8] = { nullptr };
+    treal m;             // Total Mass
+    treal size;          // Half-width of node
 
-    // Quadrupole tensor for higher-order gravity approximation
-    real Qxx = 0, Qyy = 0, Qzz = 0;
-    real Qxy = 0, Qxz = 0, Qyz = 0;
+    // Quadrupole tensor for higher-order gravity approximation (about the center of mass)
+    treal Qxx, Qyy, Qzz;
+    treal Qxy, Qxz, Qyz;
 
-    Octree(real X, real Y, real Z, real S) : x(X), y(Y), z(Z), size(S), m(0), cx(0), cy(0), cz(0) {}
+    // Index of the particle in the ParticleSystem. -1 means empty.
+    int bodyIdx;
+    int count;           // Number of particles below this node
+    bool leaf;
+
+    // Indices of the children inside Octree::nodes. -1 means no child.
+    int child[8];
 
-    ~Octree() = default;
+    real x, y, z;        // Geometric center of node
+    real cell;           // Half-width of the cell at build time ('size' may grow on refit)
 
     /**
      * @brief Determines which octant a particle belongs to.
@@ -49,74 +77,128 @@ struct Octree {
     int getOctant(real px, real py, real pz) const {
         return (px > x) * 1 + (py > y) * 2 + (pz > z) * 4;
     }
+};
+
+/**
+ * @brief Linear Barnes-Hut octree redesigned for Structure of Arrays (SoA).
+ * All nodes live in one contiguous pool that keeps its capacity between builds,
+ * so after the first step a rebuild does not touch the allocator at all.
+ * Children always get a larger index than their parent.
+ */
+struct Octree {
+    std::vector<OctreeNode> nodes;
+
+    /**
+     * @brief Drops all nodes (keeping the storage) and starts a new root.
+     */
+    void reset(real X, real Y, real Z, real S, size_t nBodies) {
+        nodes.clear();
+        if (nodes.capacity() < 2 * nBodies) nodes.reserve(2 * nBodies);
+        nodes.push_back(makeNode(X, Y, Z, S));
+    }
+
+    bool empty() const { return nodes.empty(); }
+
+    static OctreeNode makeNode(real X, real Y, real Z, real S) {
+        OctreeNode n;
+        n.cx = n.cy = n.cz = 0;
+        n.m = 0;
+        n.size = S;
+        n.Qxx = n.Qyy = n.Qzz = n.Qxy = n.Qxz = n.Qyz = 0;
+        n.bodyIdx = -1;
+        n.count = 0;
+        n.leaf = true;
+        std::fill(std::begin(n.child), std::end(n.child), -1);
+        n.x = X; n.y = Y; n.z = Z;
+        n.cell = S;
+        return n;
+    }
 
     /**
-     * @brief Creates a new child node in the specified octant.
+     * @brief Returns the child of 'parent' in octant 'idx', creating it if needed.
      */
-    std::unique_ptr<Octree> createChild(int idx) {
-        real hs = size * real(0.5);
-        return std::make_unique<Octree>(
-            x + ((idx & 1) ? hs : -hs), 
-            y + ((idx & 2) ? hs : -hs), 
-            z + ((idx & 4) ? hs : -hs), 
+    int getChild(int parent, int idx) {
+        if (nodes[parent].child[idx] >= 0) return nodes[parent].child[idx];
+
+        const OctreeNode& p = nodes[parent];
+        real hs = p.cell * real(0.5);
+        OctreeNode c = makeNode(
+            p.x + ((idx & 1) ? hs : -hs),
+            p.y + ((idx & 2) ? hs : -hs),
+            p.z + ((idx & 4) ? hs : -hs),
             hs
         );
+
+        // push_back may reallocate, so 'p' must not be used after this point
+        const int ci = static_cast<int>(nodes.size());
+        nodes.push_back(c);
+        nodes[parent].child[idx] = ci;
+        return ci;
     }
 
     /**
      * @brief Inserts a particle index into the tree.
      */
     void insert(int idx, const ParticleSystem& ps) {
-        if (leaf && bodyIdx == -1) { 
-            bodyIdx = idx; 
-            return; 
-        }
-        
-        if (leaf) {
-            leaf = false;
-            int oldIdx = bodyIdx; 
-            bodyIdx = -1;
-            int oct = getOctant(ps.x[oldIdx], ps.y[oldIdx], ps.z[oldIdx]);
-            if (!child[oct]) child[oct] = createChild(oct);
-            child[oct]->insert(oldIdx, ps);
+        int n = 0;
+        while (true) {
+            if (nodes[n].leaf && nodes[n].bodyIdx == -1) {
+                nodes[n].bodyIdx = idx;
+                return;
+            }
+
+            if (nodes[n].leaf) {
+                nodes[n].leaf = false;
+                int oldIdx = nodes[n].bodyIdx;
+                nodes[n].bodyIdx = -1;
+                int oct = nodes[n].getOctant(ps.x[oldIdx], ps.y[oldIdx], ps.z[oldIdx]);
+                nodes[getChild(n, oct)].bodyIdx = oldIdx;
+            }
+
+            int oct = nodes[n].getOctant(ps.x[idx], ps.y[idx], ps.z[idx]);
+            n = getChild(n, oct);
         }
-        
-        int oct = getOctant(ps.x[idx], ps.y[idx], ps.z[idx]);
-        if (!child[oct]) child[oct] = createChild(oct);
-        child[oct]->insert(idx, ps);
     }
 
     /**
-     * @brief Recursively computes mass properties and quadrupole moments.
+     * @brief Computes mass properties and quadrupole moments of node 'n'.
+     * The children of 'n' must already be up to date.
      */
-    void computeMass(const ParticleSystem& ps) {
-        if (leaf) {
-            if (bodyIdx != -1) { 
-                m = ps.m[bodyIdx]; 
-                cx = ps.x[bodyIdx]; cy = ps.y[bodyIdx]; cz = ps.z[bodyIdx]; 
-            } else { 
-                m = 0; cx = cy = cz = 0; 
+    void computeNodeMass(int n, const ParticleSystem& ps) {
+        OctreeNode& node = nodes[n];
+        if (node.leaf) {
+            if (node.bodyIdx != -1) {
+                node.m = ps.m[node.bodyIdx];
+                node.cx = ps.x[node.bodyIdx]; node.cy = ps.y[node.bodyIdx]; node.cz = ps.z[node.bodyIdx];
+                node.count = 1;
+            } else {
+                node.m = 0; node.cx = node.cy = node.cz = 0;
+                node.count = 0;
             }
-            Qxx = Qyy = Qzz = Qxy = Qxz = Qyz = 0;
+            node.Qxx = node.Qyy = node.Qzz = node.Qxy = node.Qxz = node.Qyz = 0;
             return;
         }
 
-        m = 0; cx = cy = cz = 0;
-        for (auto& c : child) {
-            if (!c) continue;
-            c->computeMass(ps);
-            if (c->m == 0) continue;
-            m += c->m;
-            cx += c->cx * c->m; cy += c->cy * c->m; cz += c->cz * c->m;
+        real m = 0, cx = 0, cy = 0, cz = 0;
+        int count = 0;
+        for (int ci : node.child) {
+            if (ci < 0) continue;
+            const OctreeNode& c = nodes[ci];
+            count += c.count;
+            if (c.m == 0) continue;
+            m += c.m;
+            cx += c.cx * c.m; cy += c.cy * c.m; cz += c.cz * c.m;
         }
         if (m > 0) { cx /= m; cy /= m; cz /= m; }
 
-        Qxx = Qyy = Qzz = Qxy = Qxz = Qyz = 0;
-        for (auto& c : child) {
-            if (!c || c->m == 0) continue;
-            real rx = c->cx - cx; real ry = c->cy - cy; real rz = c->cz - cz;
-            real r2 = rx * rx + ry * ry + rz * rz + (size * size * real(0.01));
-            real mc = c->m;
+        real Qxx = 0, Qyy = 0, Qzz = 0, Qxy = 0, Qxz = 0, Qyz = 0;
+        for (int ci : node.child) {
+            if (ci < 0) continue;
+            const OctreeNode& c = nodes[ci];
+            if (c.m == 0) continue;
+            real rx = c.cx - cx; real ry = c.cy - cy; real rz = c.cz - cz;
+            real r2 = rx * rx + ry * ry + rz * rz + (real(node.size) * node.size * real(0.01));
+            real mc = c.m;
             Qxx += mc * (3 * rx * rx - r2);
             Qyy += mc * (3 * ry * ry - r2);
             Qzz += mc * (3 * rz * rz - r2);
@@ -124,56 +206,352 @@ struct Octree {
             Qxz += mc * (3 * rx * rz);
             Qyz += mc * (3 * ry * rz);
         }
+
+        node.m = m; node.cx = cx; node.cy = cy; node.cz = cz;
+        node.count = count;
+        node.Qxx = Qxx; node.Qyy = Qyy; node.Qzz = Qzz;
+        node.Qxy = Qxy; node.Qxz = Qxz; node.Qyz = Qyz;
+    }
+
+    /**
+     * @brief Computes mass properties and quadrupole moments for the whole tree.
+     * Children are stored after their parents, so a reverse sweep is a bottom-up pass.
+     */
+    void computeMass(const ParticleSystem& ps) {
+        for (int n = static_cast<int>(nodes.size()) - 1; n >= 0; --n)
+            computeNodeMass(n, ps);
+    }
+
+    /**
+     * @brief Builds the tree over all particles inside the cube (X, Y, Z) +- S, including moments.
+     * Large systems are built in parallel: particles are bucketed by their cell at depth
+     * kSplitDepth, every bucket holding two or more particles becomes an independent subtree
+     * (built and reduced by one thread), and the subtrees are spliced under the shared top levels.
+     * Because a point octree does not depend on insertion order and the subtree roots use the
+     * same center arithmetic as insert(), the result is the same tree the serial build produces.
+     */
+    void build(const ParticleSystem& ps, real X, real Y, real Z, real S) {
+        const int N = static_cast<int>(ps.size());
+        reset(X, Y, Z, S, ps.size());
+
+        if (N < kParallelBuildMin || omp_get_max_threads() == 1) {
+            {
+                NEXT_PROFILE_SCOPE("tree.insert");
+                for (int i = 0; i < N; ++i) insert(i, ps);
+            }
+            NEXT_PROFILE_SCOPE("tree.mass");
+            computeMass(ps);
+            return;
+        }
+
+        {
+            NEXT_PROFILE_SCOPE("tree.bucket");
+            bucketByCell(ps);
+            buildTopLevels(ps, 0, 0, 0);
+        }
+
+        // Every subtree task fills its own pool, so the parallel part never touches 'nodes'
+        const int tasks = static_cast<int>(taskRoot.size());
+        if (static_cast<int>(subtrees.size()) < tasks) subtrees.resize(tasks);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int t = 0; t < tasks; ++t) {
+            const OctreeNode& r = nodes[taskRoot[t]];
+            Octree& sub = subtrees[t];
+            const int cell = taskCell[t];
+            sub.reset(r.x, r.y, r.z, r.cell, cellStart[cell + 1] - cellStart[cell]);
+            {
+                NEXT_PROFILE_SCOPE("tree.insert");
+                for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k)
+                    sub.insert(cellOrder[k], ps);
+            }
+            NEXT_PROFILE_SCOPE("tree.mass");
+            sub.computeMass(ps);
+        }
+
+        // Splice: each subtree root replaces its placeholder, the rest is appended contiguously
+        NEXT_PROFILE_SCOPE("tree.splice");
+        const int topCount = static_cast<int>(nodes.size());
+        std::vector<int> offset(tasks + 1);
+        offset[0] = topCount;
+        for (int t = 0; t < tasks; ++t)
+            offset[t + 1] = offset[t] + static_cast<int>(subtrees[t].nodes.size()) - 1;
+        nodes.resize(offset[tasks]);
+
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int t = 0; t < tasks; ++t) {
+            const std::vector<OctreeNode>& src = subtrees[t].nodes;
+            const int base = offset[t] - 1;
+            for (size_t k = 0; k < src.size(); ++k) {
+                OctreeNode n = src[k];
+                for (int& c : n.child) {
+                    if (c > 0) c += base;
+                }
+                nodes[k == 0 ? taskRoot[t] : base + static_cast<int>(k)] = n;
+            }
+        }
+
+        // Only the shared top levels are left for the upward pass
+        for (int n = topCount - 1; n >= 0; --n)
+            computeNodeMass(n, ps);
+    }
+
+    /**
+     * @brief Updates the tree to moved particles without changing its topology.
+     * Every internal node grows its half-width until the cube around its geometric center covers
+     * all of its particles again, so the opening criteria stay conservative, and the mass, center
+     * of mass and quadrupole moments are recomputed bottom-up (the same O(N) pass as after a build).
+     * The particles must still be in the order the tree was built for.
+     * @return false if the tree has degraded and should be rebuilt: more than maxEscaped * N
+     * particles have left their leaf cells, or some node had to grow beyond maxGrowth times its cell.
+     */
+    bool refit(const ParticleSystem& ps, real maxGrowth, real maxEscaped) {
+        if (nodes.empty() || nodes[0].count != static_cast<int>(ps.size())) return false;
+
+        growthLimit = maxGrowth;
+        escaped = 0;
+        degraded = false;
+
+        #pragma omp parallel
+        #pragma omp single
+        refitNode(0, ps);
+
+        return !degraded && escaped <= maxEscaped * real(nodes[0].count);
+    }
+
+private:
+    static constexpr int kSplitDepth = 3;                      // 512 buckets
+    static constexpr int kCells = 1 << (3 * kSplitDepth);
+    static constexpr int kParallelBuildMin = 4096;
+
+    // Scratch state of the parallel build, kept to avoid reallocating every step
+    std::vector<int> cellOf, cellOrder, cellStart;
+    std::vector<int> taskRoot, taskCell;
+    std::vector<Octree> subtrees;
+
+    // Drift metric of the running refit
+    static constexpr int kRefitTaskMin = 4096;
+    real growthLimit = real(1.5);
+    int escaped = 0;
+    bool degraded = false;
+
+    /**
+     * @brief Post-order refit of the subtree below 'n'; large subtrees are refitted as parallel tasks.
+     */
+    void refitNode(int n, const ParticleSystem& ps) {
+        OctreeNode& node = nodes[n];
+        if (node.leaf) {
+            const int i = node.bodyIdx;
+            if (i >= 0 && (std::abs(ps.x[i] - node.x) > node.cell ||
+                           std::abs(ps.y[i] - node.y) > node.cell ||
+                           std::abs(ps.z[i] - node.z) > node.cell)) {
+                #pragma omp atomic
+                ++escaped;
+            }
+            computeNodeMass(n, ps);
+            return;
+        }
+
+        if (node.count >= kRefitTaskMin) {
+            for (int c : node.child) {
+                if (c < 0) continue;
+                #pragma omp task firstprivate(c) shared(ps)
+                refitNode(c, ps);
+            }
+            #pragma omp taskwait
+        } else {
+            for (int c : node.child) {
+                if (c >= 0) refitNode(c, ps);
+            }
+        }
+
+        // Smallest cube around the geometric center that still holds every child
+        real ext = node.cell;
+        for (int c : node.child) {
+            if (c < 0) continue;
+            const OctreeNode& ch = nodes[c];
+            real e;
+            if (ch.leaf) {
+                if (ch.bodyIdx < 0) continue;
+                const int i = ch.bodyIdx;
+                e = std::max({ std::abs(ps.x[i] - node.x), std::abs(ps.y[i] - node.y), std::abs(ps.z[i] - node.z) });
+            } else {
+                e = std::max({ std::abs(ch.x - node.x), std::abs(ch.y - node.y), std::abs(ch.z - node.z) }) + ch.size;
+            }
+            ext = std::max(ext, e);
+        }
+        node.size = ext;
+
+        if (ext > growthLimit * node.cell) {
+            #pragma omp atomic write
+            degraded = true;
+        }
+        computeNodeMass(n, ps);
+    }
+
+    /**
+     * @brief Counting sort of the particle indices by their cell at depth kSplitDepth.
+     * The cell of a particle is found by descending from the root with the same comparisons
+     * and child centers as insert(), so a bucket is exactly the particle set of that node.
+     */
+    void bucketByCell(const ParticleSystem& ps) {
+        const int N = static_cast<int>(ps.size());
+
+        // Geometry of the cells above the split depth, laid out level by level
+        std::vector<OctreeNode> levels;
+        levels.push_back(nodes[0]);
+        for (int l = 0, first = 0, count = 1; l < kSplitDepth - 1; ++l, first += count, count *= 8) {
+            for (int k = 0; k < count; ++k) {
+                const OctreeNode p = levels[first + k];
+                real hs = p.cell * real(0.5);
+                for (int idx = 0; idx < 8; ++idx) {
+                    levels.push_back(makeNode(
+                        p.x + ((idx & 1) ? hs : -hs),
+                        p.y + ((idx & 2) ? hs : -hs),
+                        p.z + ((idx & 4) ? hs : -hs),
+                        hs));
+                }
+            }
+        }
+
+        cellOf.resize(N);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; ++i) {
+            int code = 0, first = 0, count = 1;
+            for (int l = 0; l < kSplitDepth; ++l) {
+                const OctreeNode& c = levels[first + code];
+                code = code * 8 + c.getOctant(ps.x[i], ps.y[i], ps.z[i]);
+                first += count;
+                count *= 8;
+            }
+            cellOf[i] = code;
+        }
+
+        // Stable counting sort, so every bucket keeps ascending particle order
+        cellStart.assign(kCells + 1, 0);
+        for (int i = 0; i < N; ++i) cellStart[cellOf[i] + 1]++;
+        for (int c = 0; c < kCells; ++c) cellStart[c + 1] += cellStart[c];
+
+        std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+        cellOrder.resize(N);
+        for (int i = 0; i < N; ++i) cellOrder[fill[cellOf[i]]++] = i;
+
+        taskRoot.clear();
+        taskCell.clear();
+    }
+
+    /**
+     * @brief Recreates the tree above the split depth from the bucket counts.
+     * Mirrors insert(): empty octants get no node, single particles stay in a leaf,
+     * and nodes at the split depth with two or more particles are queued as subtree tasks.
+     */
+    void buildTopLevels(const ParticleSystem& ps, int n, int level, int code) {
+        const int span  = 1 << (3 * (kSplitDepth - level));
+        const int first = code * span;
+        const int count = cellStart[first + span] - cellStart[first];
+
+        if (count == 1) {
+            nodes[n].bodyIdx = cellOrder[cellStart[first]];
+            return;
+        }
+        if (level == kSplitDepth) {
+            taskRoot.push_back(n);
+            taskCell.push_back(code);
+            nodes[n].leaf = false;
+            return;
+        }
+
+        nodes[n].leaf = false;
+        const int childSpan = span / 8;
+        for (int oct = 0; oct < 8; ++oct) {
+            const int cfirst = first + oct * childSpan;
+            if (cellStart[cfirst + childSpan] == cellStart[cfirst]) continue;
+            int c = getChild(n, oct);
+            buildTopLevels(ps, c, level + 1, code * 8 + oct);
+        }
     }
 };
 
 /**
- * @brief Barnes-Hut acceleration calculation for a target particle at index 'i'.
+ * @brief Softening between 'node' and a target particle of mass m and type 'type' at distance 'dist'.
+ * Dark Matter (type 1) targets are softened at least to the mean particle spacing inside the node.
+ */
+inline treal nodeSoftening(const OctreeNode& node, treal dist, int type, treal m) {
+    treal eps = nextSoftening(node.size, node.m, dist);
+    if (type == 1) {
+        eps = std::max(eps, treal(2.0) * node.size / std::pow(node.m / m, treal(0.333333333)));
+    }
+    return eps;
+}
+
+/**
+ * @brief Monopole and quadrupole acceleration of 'node' at a point offset by -(dx, dy, dz)
+ * from its center of mass. dist_inv is the softened inverse distance.
+ * The terms are evaluated in the force precision and summed into accumulators of the state precision.
  */
-inline void bhAccel(Octree* node, int i, const ParticleSystem& ps, real theta, real& ax, real& ay, real& az) {
-    if (!node || node->m == 0) return;
-    if (node->leaf && node->bodyIdx == i) return;
+inline void multipoleAccel(const OctreeNode& node, treal dx, treal dy, treal dz, treal dist_inv,
+                           real& ax, real& ay, real& az) {
+    constexpr treal G = treal(1.0);
+    treal inv3 = dist_inv * dist_inv * dist_inv;
+    treal fac = G * node.m * inv3;
 
-    constexpr real G = real(1.0);
-    real dx = node->cx - ps.x[i]; 
-    real dy = node->cy - ps.y[i]; 
-    real dz = node->cz - ps.z[i];
-    real r2 = dx*dx + dy*dy + dz*dz;
-    real dist = std::sqrt(r2 + real(1e-20));
+    ax += dx * fac; ay += dy * fac; az += dz * fac;
 
-    // Adaptive softening for Dark Matter (type 1) vs Stars (type 0)
-    real eps = nextSoftening(node->size, node->m, dist);
-    if (ps.type[i] == 1) {
-        eps = std::max(eps, 2.0 * node->size / std::pow(node->m / ps.m[i], 0.333333333));
-    }
+    // Quadrupole contributions
+    treal inv5 = inv3 * (dist_inv * dist_inv);
+    treal inv7 = inv5 * (dist_inv * dist_inv);
 
-    real r2_soft = r2 + eps*eps;
-    real dist_inv = real(1.0) / std::sqrt(r2_soft);
+    treal q = node.Qxx*dx*dx + node.Qyy*dy*dy + node.Qzz*dz*dz +
+              2*(node.Qxy*dx*dy + node.Qxz*dx*dz + node.Qyz*dy*dz);
 
-    if (node->leaf || (node->size / dist) < theta) {
-        real inv3 = dist_inv * dist_inv * dist_inv;
-        real fac = G * node->m * inv3;
+    treal Qrx = 2*(node.Qxx*dx + node.Qxy*dy + node.Qxz*dz);
+    treal Qry = 2*(node.Qxy*dx + node.Qyy*dy + node.Qyz*dz);
+    treal Qrz = 2*(node.Qxz*dx + node.Qyz*dy + node.Qzz*dz);
+
+    ax += (G * treal(0.5)) * (Qrx * inv5 - 5 * q * inv7 * dx);
+    ay += (G * treal(0.5)) * (Qry * inv5 - 5 * q * inv7 * dy);
+    az += (G * treal(0.5)) * (Qrz * inv5 - 5 * q * inv7 * dz);
+}
 
-        ax += dx * fac; ay += dy * fac; az += dz * fac;
+/**
+ * @brief Barnes-Hut acceleration from node 'n' (and below) on the target particle at index 'i'.
+ * If 'interactions' is given, it is incremented once per evaluated node.
+ */
+inline void bhAccelNode(const OctreeNode* nodes, int n, int i, const ParticleSystem& ps, real theta, real& ax, real& ay, real& az,
+                        int* interactions = nullptr) {
+    const OctreeNode& node = nodes[n];
+    if (node.m == 0) return;
+    if (node.leaf && node.bodyIdx == i) return;
 
-        // Quadrupole contributions
-        real inv5 = inv3 * (dist_inv * dist_inv);
-        real inv7 = inv5 * (dist_inv * dist_inv);
+    // The offset is taken in the state precision, so only the (small) relative vector is rounded
+    treal dx = treal(node.cx - ps.x[i]);
+    treal dy = treal(node.cy - ps.y[i]);
+    treal dz = treal(node.cz - ps.z[i]);
+    treal r2 = dx*dx + dy*dy + dz*dz;
+    treal dist = std::sqrt(r2 + treal(1e-20));
 
-        real q = node->Qxx*dx*dx + node->Qyy*dy*dy + node->Qzz*dz*dz + 
-                 2*(node->Qxy*dx*dy + node->Qxz*dx*dz + node->Qyz*dy*dz);
+    // Adaptive softening for Dark Matter (type 1) vs Stars (type 0)
+    treal eps = nodeSoftening(node, dist, ps.type[i], treal(ps.m[i]));
 
-        real Qrx = 2*(node->Qxx*dx + node->Qxy*dy + node->Qxz*dz);
-        real Qry = 2*(node->Qxy*dx + node->Qyy*dy + node->Qyz*dz);
-        real Qrz = 2*(node->Qxz*dx + node->Qyz*dy + node->Qzz*dz);
+    treal r2_soft = r2 + eps*eps;
+    treal dist_inv = treal(1.0) / std::sqrt(r2_soft);
 
-        ax += (G * real(0.5)) * (Qrx * inv5 - 5 * q * inv7 * dx);
-        ay += (G * real(0.5)) * (Qry * inv5 - 5 * q * inv7 * dy);
-        az += (G * real(0.5)) * (Qrz * inv5 - 5 * q * inv7 * dz);
+    if (node.leaf || (node.size / dist) < theta) {
+        multipoleAccel(node, dx, dy, dz, dist_inv, ax, ay, az);
+        if (interactions) ++*interactions;
         return;
     }
 
-    for (auto& c : node->child) {
-        if (c) bhAccel(c.get(), i, ps, theta, ax, ay, az);
+    for (int c : node.child) {
+        if (c >= 0) bhAccelNode(nodes, c, i, ps, theta, ax, ay, az, interactions);
     }
 }
+
+/**
+ * @brief Barnes-Hut acceleration calculation for a target particle at index 'i'.
+ */
+inline void bhAccel(const Octree& tree, int i, const ParticleSystem& ps, real theta, real& ax, real& ay, real& az,
+                    int* interactions = nullptr) {
+    if (tree.empty()) return;
+    bhAccelNode(tree.nodes.data(), 0, i, ps, theta, ax, ay, az, interactions);
+}
@@ -11,194 +11,493 @@
 
 #pragma once
 #include "floatdef.h"
+#include "config.h"
+#include "direct.h"
+#include "fmm.h"
+#include "groupwalk.h"
+#include "morton.h"
 #include "octree.h"
+#include "thetatune.h"
+#include "dt/block.h"
 #include "struct/particle.h"
-#include <memory>
+#include "util/profile.h"
 #include <algorithm>
 #include <omp.h>
 #ifdef NEXT_MPI
     #include <mpi.h>
+    #include "parallel/domain.h"
 #endif
 #include <chrono>
 #include <fstream>
 
-inline void Step(ParticleSystem &ps, real dt) {
-    if (ps.size() == 0) return;
+/**
+ * @brief Builds the Barnes-Hut tree over all particles into 'tree'.
+ * The node pool of 'tree' is reused, so repeated builds do not reallocate.
+ */
+inline void buildTree(Octree& tree, const ParticleSystem& ps) {
+    BBox global;
+    {
+        NEXT_PROFILE_SCOPE("tree.bounds");
+#ifdef NEXT_MPI
+        global = globalBounds(ps);
+#else
+        global = computeBounds(ps);
+#endif
+    }
 
-    #ifdef NEXT_BENCHMARK
-    auto t_start = std::chrono::high_resolution_clock::now();
-    #endif
+    const real cx   = (global.minx + global.maxx) * real(0.5);
+    const real cy   = (global.miny + global.maxy) * real(0.5);
+    const real cz   = (global.minz + global.maxz) * real(0.5);
+    real       size = std::max({global.maxx - global.minx,
+                                global.maxy - global.miny,
+                                global.maxz - global.minz}) * real(0.5);
 
-    const real theta = real(0.5);
-    const real half  = dt * real(0.5);
-    const int  N     = static_cast<int>(ps.size());
+    if (size <= real(0)) size = real(1.0);
+
+    NEXT_PROFILE_SCOPE("tree.build");
+    tree.build(ps, cx, cy, cz, size);
+}
 
+/**
+ * @brief Solver state kept between steps (shared by Step and StepBlock).
+ */
+struct StepState {
+    Octree tree;               // Node storage is reused, so only the first build allocates
+    Fmm fmm;                   // Local expansions of the FMM solver
+    DirectSum direct;          // Source blocks of the direct summation
+    long long stepCount = 0;
+    bool treeStale = true;     // The particle order changed since the last build, so refit is impossible
+    long long treeBuilds = 0, treeRefits = 0;
+
+    // Opening angle in use; tuned every cfg.thetaInterval steps when cfg.forceError > 0
+    ThetaTuner tuner;
+    real theta = real(0);      // 0 until the first step takes cfg.theta
+    bool tuneDue = false;      // The next force evaluation re-tunes theta first
+
+    // Load balance of the force evaluations, accumulated over one step
+    double forceTime = 0;                 // Wall time this rank spent in force walks
+    std::vector<double> threadBusy;       // Time each OpenMP thread spent working in them
+    double rankImbalance = 0;             // Slowest / mean - 1 of the last step, across ranks
+    double threadImbalance = 0;           // ... and across the threads of this rank
 #ifdef NEXT_MPI
-    int rank, size;
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
-
-    MPI_Datatype MPI_REAL_T;
-#  ifdef NEXT_FP64
-    MPI_REAL_T = MPI_DOUBLE;
-#  elif defined(NEXT_FP32)
-    MPI_REAL_T = MPI_FLOAT;
-#  else
-#    error "Define NEXT_FP32 or NEXT_FP64 for 'real' type."
-#  endif
-#else
-    int rank = 0;
-    int size = 1;
+    Domain domain;             // Splitters and ghost moments of the domain decomposition
+    Octree letTree;            // Local particles plus the ghosts imported from the other ranks
 #endif
+};
+
+inline StepState& stepState() {
+    static StepState state;
+    return state;
+}
+
+/**
+ * @brief Opening angle of the force walks: the tuned one when tuning is on, else cfg.theta.
+ * Callers that skip prepareStep() (e.g. next_bench) always get cfg.theta.
+ */
+inline real openingAngle(const StepState& st, const GravityConfig& cfg) {
+    return (cfg.forceError > real(0) && st.theta > real(0)) ? st.theta : cfg.theta;
+}
 
-    const int start = (rank * N) / size;
-    const int end   = ((rank + 1) * N) / size;
+/**
+ * @brief Reorders the particles when due and makes sure the acceleration lanes are sized.
+ */
+inline void prepareStep(ParticleSystem& ps, const GravityConfig& cfg) {
+    StepState& st = stepState();
 
+    // Spatially sorted lanes keep neighbouring force-loop iterations on the same tree branches
+    const bool reorder = cfg.reorderInterval > 0 && st.stepCount % cfg.reorderInterval == 0;
 #ifdef NEXT_MPI
-    std::vector<int> counts(size), displs(size);
-    for (int r = 0; r < size; ++r) {
-        const int s = (r * N) / size;
-        const int e = ((r + 1) * N) / size;
-        counts[r]   = e - s;
-        displs[r]   = s;
+    // Under MPI the sort is global: particles migrate to the rank owning their part of the curve.
+    // The first step always decomposes, as the particles start out in file order, and
+    // decomposeInterval keeps particles migrating and ranks balanced when reordering is off.
+    const bool rebalance = cfg.decomposeInterval > 0 && st.stepCount % cfg.decomposeInterval == 0;
+    if (reorder || rebalance || st.stepCount == 0) {
+        NEXT_PROFILE_SCOPE("domain.decompose");
+        st.domain.decompose(ps);
+        st.treeStale = true;
+    }
+#else
+    if (reorder) {
+        NEXT_PROFILE_SCOPE("reorder");
+        reorderParticles(ps);
+        st.treeStale = true;
     }
 #endif
+    if (st.theta <= real(0) || cfg.forceError <= real(0)) st.theta = cfg.theta;
+    st.tuneDue = cfg.forceError > real(0) && st.stepCount % std::max(cfg.thetaInterval, 1) == 0;
+    ++st.stepCount;
 
-    auto buildTree = [&]() -> std::unique_ptr<Octree> {
-        struct BBox { real minx, miny, minz, maxx, maxy, maxz; };
-        BBox local{ real(1e30), real(1e30), real(1e30),
-                    real(-1e30), real(-1e30), real(-1e30) };
-
-        for (int i = 0; i < N; ++i) {
-            local.minx = std::min(local.minx, ps.x[i]);
-            local.miny = std::min(local.miny, ps.y[i]);
-            local.minz = std::min(local.minz, ps.z[i]);
-            local.maxx = std::max(local.maxx, ps.x[i]);
-            local.maxy = std::max(local.maxy, ps.y[i]);
-            local.maxz = std::max(local.maxz, ps.z[i]);
-        }
+    // Accelerations at the current positions. They survive the step, so the forces of
+    // the second kick can serve as the first kick of the next step.
+    if (ps.ax.size() != ps.size()) {
+        const size_t N = ps.size();
+        ps.ax.assign(N, 0); ps.ay.assign(N, 0); ps.az.assign(N, 0);
+        ps.accValid = false;
+    }
+
+    st.forceTime = 0;
+    st.threadBusy.assign(omp_get_max_threads(), 0.0);
+}
 
+/**
+ * @brief Turns the force timings of the finished step into imbalance figures (slowest / mean - 1),
+ * across ranks and across the threads of this rank.
+ */
+inline void finishLoadStats(StepState& st) {
+    NEXT_PROFILE_SCOPE("load.stats");
+    double tMax = st.forceTime, tSum = st.forceTime;
+    int ranks = 1;
 #ifdef NEXT_MPI
-        real mins[3] = {local.minx, local.miny, local.minz};
-        real maxs[3] = {local.maxx, local.maxy, local.maxz};
+    MPI_Allreduce(&st.forceTime, &tMax, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&st.forceTime, &tSum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+#endif
+    st.rankImbalance = (tSum > 0) ? tMax / (tSum / ranks) - 1 : 0;
 
-        MPI_Allreduce(MPI_IN_PLACE, mins, 3, MPI_REAL_T, MPI_MIN, MPI_COMM_WORLD);
-        MPI_Allreduce(MPI_IN_PLACE, maxs, 3, MPI_REAL_T, MPI_MAX, MPI_COMM_WORLD);
+    double bMax = 0, bSum = 0;
+    for (double b : st.threadBusy) { bMax = std::max(bMax, b); bSum += b; }
+    st.threadImbalance = (bSum > 0) ? bMax / (bSum / st.threadBusy.size()) - 1 : 0;
+}
 
-        BBox global{mins[0], mins[1], mins[2], maxs[0], maxs[1], maxs[2]};
-#else
-        BBox global = local;
-#endif
+/**
+ * @brief Splits [start, end) into 'chunks' index ranges of about equal predicted work.
+ * The prediction is ps.cost from the previous evaluation; inactive targets cost nothing, and
+ * targets without a recorded cost yet count as one interaction.
+ */
+inline void costChunks(const ParticleSystem& ps, int start, int end, int chunks,
+                       const std::vector<unsigned char>* active, std::vector<int>& bounds) {
+    std::vector<double> prefix(end - start + 1, 0.0);
+    for (int i = start; i < end; ++i) {
+        double w = (active && !(*active)[i]) ? 0.0 : std::max(double(ps.cost[i]), 1.0);
+        prefix[i - start + 1] = prefix[i - start] + w;
+    }
+
+    bounds.resize(chunks + 1);
+    bounds[0] = start;
+    for (int c = 1; c < chunks; ++c) {
+        const double target = prefix.back() * c / chunks;
+        bounds[c] = start + static_cast<int>(std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin());
+        bounds[c] = std::max(bounds[c], bounds[c - 1]);
+    }
+    bounds[chunks] = end;
+}
 
-        const real cx   = (global.minx + global.maxx) * real(0.5);
-        const real cy   = (global.miny + global.maxy) * real(0.5);
-        const real cz   = (global.minz + global.maxz) * real(0.5);
-        real       size = std::max({global.maxx - global.minx,
-                                    global.maxy - global.miny,
-                                    global.maxz - global.minz}) * real(0.5);
+/**
+ * @brief Mean interaction count (ps.cost) of the targets in [start, end) that are active.
+ */
+inline double meanCost(const ParticleSystem& ps, int start, int end, const std::vector<unsigned char>* active) {
+    double sum = 0;
+    long long n = 0;
+    for (int i = start; i < end; ++i) {
+        if (active && !(*active)[i]) continue;
+        sum += ps.cost[i];
+        ++n;
+    }
+    return n > 0 ? sum / n : 0.0;
+}
 
-        if (size <= real(0)) size = real(1.0);
+/**
+ * @brief Brings 'tree' up to date with the current positions.
+ * In TreeUpdate::Refit mode the previous tree is refitted, and only rebuilt when the particle
+ * order changed (reordering) or the refit reports that the tree has degraded.
+ */
+inline void updateTree(Octree& tree, const ParticleSystem& ps, const GravityConfig& cfg) {
+    StepState& st = stepState();
+    if (cfg.treeUpdate == TreeUpdate::Refit && !st.treeStale) {
+        NEXT_PROFILE_SCOPE("tree.refit");
+        if (tree.refit(ps, cfg.refitGrowth, cfg.refitEscaped)) {
+            ++st.treeRefits;
+            return;
+        }
+    }
 
-        auto root = std::make_unique<Octree>(cx, cy, cz, size);
+    buildTree(tree, ps);
+    st.treeStale = false;
+    ++st.treeBuilds;
+}
 
-        for (int i = 0; i < N; ++i)
-            root->insert(i, ps);
+/**
+ * @brief True if the forces come from direct summation: asked for, or the total particle
+ * count (over all ranks) is below cfg.directBelow, where building a tree does not pay off.
+ * The direct sum uses pairSoftening(), not the tree's nodeSoftening(), hence directBelow is opt-in.
+ */
+inline bool useDirectSum(const ParticleSystem& ps, const GravityConfig& cfg) {
+    if (cfg.solver == GravitySolver::Direct) return true;
+    long long total = static_cast<long long>(ps.size());
+#ifdef NEXT_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    return total < cfg.directBelow;
+}
 
-        root->computeMass(ps);
-        return root;
-    };
+/**
+ * @brief Updates the tree and stores the accelerations of the targets in [start, end) in ps.ax/ay/az.
+ * If 'active' is given, only targets with active[i] != 0 are evaluated. Small systems skip the
+ * tree and use direct summation (see useDirectSum).
+ * Under MPI the forces come from the locally essential tree: the local tree plus the ghosts
+ * the other ranks export for this rank's particles (see parallel/domain.h).
+ */
+inline void computeForces(ParticleSystem& ps, Octree& tree, const GravityConfig& cfg,
+                          int start, int end, const std::vector<unsigned char>* active = nullptr) {
+    StepState& load = stepState();
+    if (ps.cost.size() != ps.size()) ps.cost.assign(ps.size(), 0);
+    if (load.threadBusy.size() < static_cast<size_t>(omp_get_max_threads()))
+        load.threadBusy.resize(omp_get_max_threads(), 0.0);
 
-    // FIRST KICK
+    if (useDirectSum(ps, cfg)) {
+        const double t0 = omp_get_wtime();
+        {
+            NEXT_PROFILE_SCOPE("force");
+            load.direct.accel(ps, start, end, active, load.threadBusy.data());
+        }
+        load.forceTime += omp_get_wtime() - t0;
+        load.treeStale = true;   // The tree was not kept up to date, so it cannot be refitted
+        NEXT_PROFILE_COUNTER("force.interactions_per_particle", meanCost(ps, start, end, active));
+        return;
+    }
+
+    updateTree(tree, ps, cfg);
+
+#ifdef NEXT_MPI
+    StepState& st = stepState();
+    const int nLocal = static_cast<int>(ps.size());
     {
-        auto root = buildTree();
+        NEXT_PROFILE_SCOPE("ghosts");
+        st.domain.importGhosts(tree, ps, openingAngle(st, cfg));
+        buildTree(st.letTree, ps);
+        st.domain.patchGhostLeaves(st.letTree, nLocal);
+    }
+    const Octree& forceTree = st.letTree;
+#else
+    const Octree& forceTree = tree;
+#endif
 
-        #pragma omp parallel for schedule(dynamic, 64)
-        for (int i = start; i < end; ++i) {
-            real ax = real(0), ay = real(0), az = real(0);
-            bhAccel(root.get(), i, ps, theta, ax, ay, az);
+    // Under MPI the ghosts were exported for the previous theta, so the search measures the error
+    // against the locally essential tree; the next step exports for the tuned value.
+    if (load.tuneDue) {
+        NEXT_PROFILE_SCOPE("theta.tune");
+#ifdef NEXT_MPI
+        int rank = 0;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#else
+        const int rank = 0;
+#endif
+        const uint64_t seed = static_cast<uint64_t>(load.stepCount) * 0x9E3779B97F4A7C15ULL + static_cast<uint64_t>(rank);
+        load.theta = load.tuner.tune(forceTree, ps, cfg, load.fmm, load.theta, start, end, seed);
+        load.tuneDue = false;
+        NEXT_PROFILE_COUNTER("theta", load.theta);
+        NEXT_PROFILE_COUNTER("theta.error", load.tuner.error);
+    }
+    const real theta = openingAngle(load, cfg);
+
+    const double t0 = omp_get_wtime();
+    NEXT_PROFILE_SCOPE("force");
+
+    if (cfg.solver == GravitySolver::Fmm) {
+        load.fmm.accel(forceTree, ps, theta, start, end, active);
+    } else if (cfg.walk == TreeWalk::Group) {
+        groupAccel(forceTree, ps, theta, cfg.groupSize, start, end, active, load.threadBusy.data());
+    } else {
+        // Chunks of equal predicted work (from the interaction counts of the last evaluation)
+        const int chunks = std::min(end - start, 8 * omp_get_max_threads());
+        std::vector<int> bounds;
+        if (chunks > 0) costChunks(ps, start, end, chunks, active, bounds);
 
-            ps.vx[i] += ax * half;
-            ps.vy[i] += ay * half;
-            ps.vz[i] += az * half;
+        #pragma omp parallel
+        {
+            NEXT_PROFILE_SCOPE("force.thread");
+            const double busy0 = omp_get_wtime();
+            InteractionList pp, pc;
+            std::vector<int> stack;
+
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int c = 0; c < chunks; ++c) {
+                for (int i = bounds[c]; i < bounds[c + 1]; ++i) {
+                    if (active && !(*active)[i]) continue;
+                    real ax = real(0), ay = real(0), az = real(0);
+                    const int interactions = listAccel(forceTree, i, ps, theta, pp, pc, stack, ax, ay, az);
+                    ps.ax[i] = ax; ps.ay[i] = ay; ps.az[i] = az;
+                    ps.cost[i] = real(interactions);
+                }
+            }
+
+            load.threadBusy[omp_get_thread_num()] += omp_get_wtime() - busy0;
         }
+    }
+
+    load.forceTime += omp_get_wtime() - t0;
+    NEXT_PROFILE_COUNTER("tree.nodes", forceTree.nodes.size());
+    NEXT_PROFILE_COUNTER("force.interactions_per_particle", meanCost(ps, start, end, active));
 
 #ifdef NEXT_MPI
-        MPI_Request reqs[3];
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vx.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs[0]);
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vy.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs[1]);
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vz.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs[2]);
-        MPI_Waitall(3, reqs, MPI_STATUSES_IGNORE);
+    Domain::dropGhosts(ps, nLocal);
 #endif
-    }
+}
 
-    // DRIFT
+/**
+ * @brief Moves the particles in [start, end) along their velocities for a time dt.
+ */
+inline void drift(ParticleSystem& ps, real dt, int start, int end) {
+    NEXT_PROFILE_SCOPE("drift");
     #pragma omp parallel for schedule(static)
     for (int i = start; i < end; ++i) {
         ps.x[i] += ps.vx[i] * dt;
         ps.y[i] += ps.vy[i] * dt;
         ps.z[i] += ps.vz[i] * dt;
     }
+}
 
-#ifdef NEXT_MPI
-    MPI_Request reqs3[3];
-    MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                    ps.x.data(), counts.data(), displs.data(), MPI_REAL_T,
-                    MPI_COMM_WORLD, &reqs3[0]);
-    MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                    ps.y.data(), counts.data(), displs.data(), MPI_REAL_T,
-                    MPI_COMM_WORLD, &reqs3[1]);
-    MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                    ps.z.data(), counts.data(), displs.data(), MPI_REAL_T,
-                    MPI_COMM_WORLD, &reqs3[2]);
-    MPI_Waitall(3, reqs3, MPI_STATUSES_IGNORE);
+inline void Step(ParticleSystem &ps, real dt, const GravityConfig &cfg = GravityConfig()) {
+#ifndef NEXT_MPI
+    // Under MPI a rank without particles still takes part in the collective calls
+    if (ps.size() == 0) return;
 #endif
 
-    // SECOND KICK
-    {
-        auto root = buildTree();
+    #ifdef NEXT_BENCHMARK
+    auto t_start = std::chrono::high_resolution_clock::now();
+    #endif
+    NEXT_PROFILE_SCOPE("step");
 
-        #pragma omp parallel for schedule(dynamic, 64)
-        for (int i = start; i < end; ++i) {
-            real ax = real(0), ay = real(0), az = real(0);
-            bhAccel(root.get(), i, ps, theta, ax, ay, az);
+    const real half  = dt * real(0.5);
+
+    prepareStep(ps, cfg);
+    Octree& tree = stepState().tree;
 
-            ps.vx[i] += ax * half;
-            ps.vy[i] += ay * half;
-            ps.vz[i] += az * half;
+    // Every rank owns its particles, so all of them are targets
+    const int start = 0;
+    const int end   = static_cast<int>(ps.size());
+
+    auto kick = [&]() {
+        NEXT_PROFILE_SCOPE("kick");
+        #pragma omp parallel for schedule(static)
+        for (int i = start; i < end; ++i) {
+            ps.vx[i] += ps.ax[i] * half;
+            ps.vy[i] += ps.ay[i] * half;
+            ps.vz[i] += ps.az[i] * half;
         }
+    };
 
-#ifdef NEXT_MPI
-        MPI_Request reqs4[3];
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vx.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs4[0]);
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vy.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs4[1]);
-        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_REAL_T,
-                        ps.vz.data(), counts.data(), displs.data(), MPI_REAL_T,
-                        MPI_COMM_WORLD, &reqs4[2]);
-        MPI_Waitall(3, reqs4, MPI_STATUSES_IGNORE);
-#endif
+    // FIRST KICK
+    {
+        // Positions have not changed since the previous second kick, so its forces are still exact
+        if (!ps.accValid) computeForces(ps, tree, cfg, start, end);
+        kick();
+    }
+
+    // DRIFT
+    drift(ps, dt, start, end);
+
+    // SECOND KICK
+    {
+        computeForces(ps, tree, cfg, start, end);
+        kick();
+        ps.accValid = true;
     }
 
+    finishLoadStats(stepState());
+
 #ifdef NEXT_BENCHMARK
     auto t_end = std::chrono::high_resolution_clock::now();
     double elapsed_ms = std::chrono::duration<double, std::milli>(t_end - t_start).count();
 
-    int rank = 0;
 #ifdef NEXT_MPI
+    int rank = 0;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#else
+    const int rank = 0;
 #endif
     if (rank == 0) {
-        std::ofstream log("log.txt", std::ios::app);
-        log << "Step time: " << elapsed_ms << " ms" << std::endl;
+        // Opened once: reopening the file every step showed up in the timings of small runs
+        static std::ofstream log("log.txt", std::ios::app);
+        log << "Step time: " << elapsed_ms << " ms"
+            << ", force imbalance: ranks " << stepState().rankImbalance * 100 << "%"
+            << ", threads " << stepState().threadImbalance * 100 << "%" << std::endl;
     }
 #endif
 }
+
+/**
+ * @brief Advances the system by dtMax using hierarchical power-of-two block timesteps.
+ * Particle i lives on rung r_i with step dtMax / 2^r_i (see dt/block.h). Time is counted in
+ * units of the finest allowed step dtMax / 2^maxRung; the loop jumps from one sync time of the
+ * finest occupied rung to the next. At each sync time only the particles whose step ends there
+ * are active: the tree is rebuilt once, forces are evaluated for the active particles only,
+ * they get their closing half-kick, pick a new rung and immediately open their next step.
+ * Every particle ends the call synchronised, with valid accelerations.
+ */
+inline void StepBlock(ParticleSystem &ps, real dtMax, const GravityConfig &cfg = GravityConfig()) {
+#ifndef NEXT_MPI
+    if (ps.size() == 0) return;
+#endif
+    NEXT_PROFILE_SCOPE("step");
+
+    prepareStep(ps, cfg);
+    Octree& tree = stepState().tree;
+
+    const int N = static_cast<int>(ps.size());
+    const int start = 0;
+    const int end   = N;
+
+    const int maxRung = std::max(0, std::min(cfg.maxRung, 30));
+    const long long T = 1LL << maxRung;
+    const real dtMin = dtMax / real(T);
+    auto stride = [&](int r) { return 1LL << (maxRung - r); };
+
+    // Start of the big step: everybody is synchronised and gets a rung from its acceleration
+    if (!ps.accValid) computeForces(ps, tree, cfg, start, end);
+    if (ps.rung.size() != ps.size()) ps.rung.assign(N, 0);
+    {
+        NEXT_PROFILE_SCOPE("rungs");
+        assignRungs(ps, start, end, dtMax, cfg.blockEta, maxRung, 0);
+    }
+
+    std::vector<unsigned char> active(N, 1);
+
+    // Half-kick of the active particles over half of their own step
+    auto kick = [&]() {
+        NEXT_PROFILE_SCOPE("kick");
+        #pragma omp parallel for schedule(static)
+        for (int i = start; i < end; ++i) {
+            if (!active[i]) continue;
+            const real h = real(0.5) * dtMin * real(stride(ps.rung[i]));
+            ps.vx[i] += ps.ax[i] * h;
+            ps.vy[i] += ps.ay[i] * h;
+            ps.vz[i] += ps.az[i] * h;
+        }
+    };
+
+    long long t = 0;
+    while (t < T) {
+        // Opening half-kick for every particle that starts a step at t
+        kick();
+
+        // Drift everybody to the next sync time of the finest occupied rung (on any rank)
+        int finest = N > 0 ? *std::max_element(ps.rung.begin(), ps.rung.end()) : 0;
+#ifdef NEXT_MPI
+        MPI_Allreduce(MPI_IN_PLACE, &finest, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+#endif
+        const long long next = t + stride(finest);
+        const real dt = dtMin * real(next - t);
+
+        drift(ps, dt, start, end);
+        t = next;
+
+        // Particles whose step ends at t
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; ++i)
+            active[i] = (t % stride(ps.rung[i]) == 0) ? 1 : 0;
+
+        computeForces(ps, tree, cfg, start, end, &active);
+
+        // Closing half-kick with the old step, then a new rung for the next one
+        kick();
+
+        if (t < T) {
+            NEXT_PROFILE_SCOPE("rungs");
+            assignRungs(ps, start, end, dtMax, cfg.blockEta, maxRung, t, &active);
+        }
+    }
+
+    ps.accValid = true;
+    finishLoadStats(stepState());
+}
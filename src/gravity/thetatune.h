@@ -0,0 +1,158 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "config.h"
+#include "direct.h"
+#include "fmm.h"
+#include "groupwalk.h"
+#include "octree.h"
+#include "struct/particle.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+#ifdef NEXT_MPI
+    #include <mpi.h>
+#endif
+
+/**
+ * @brief Opening-angle search against a force-error budget (GravityConfig::forceError).
+ * A random sample of targets gets its reference acceleration from DirectSum::reference(), a
+ * direct sum over the particles of all ranks with the same softening as the tree leaves, and
+ * the configured solver is run for the sample at candidate angles. The measured error is thus
+ * that of the multipole approximation, the node softening and, under MPI, the ghosts together. The error measure is the RMS relative force error of the
+ * sample, summed over all ranks so every rank picks the same angle.
+ */
+struct ThetaTuner {
+    static constexpr real kMin = real(0.1);     // Below this the walks approach O(N^2)
+    static constexpr real kMax = real(1.0);
+    static constexpr int kMaxProbes = 6;        // Looser angles tried while within budget
+
+    real error = 0;                             // Measured error of the chosen angle
+    bool met = true;                            // Whether 'error' is within the budget
+
+    /**
+     * @brief Returns the largest theta in [kMin, kMax] whose measured error is within the
+     * budget, searching outwards from 'theta' in steps of 25%. Tightening goes all the way down
+     * to kMin if needed; if even kMin misses the budget it is returned anyway and 'met' is
+     * cleared. 'tree' must be built over the current positions; targets are drawn
+     * from [start, end), and [0, end) are this rank's own particles (any ghosts follow them).
+     * The accelerations and costs of ps are left as they were.
+     */
+    real tune(const Octree& tree, ParticleSystem& ps, const GravityConfig& cfg, Fmm& fmm,
+              real theta, int start, int end, uint64_t seed) {
+        targetEnd = end;
+        pickSample(start, end, cfg.thetaSample, seed);
+        {
+            NEXT_PROFILE_SCOPE("theta.reference");
+            direct.reference(tree, ps, end, sample, ex, ey, ez);
+        }
+
+        theta = std::min(std::max(theta, kMin), kMax);
+        real e = measure(tree, ps, cfg, fmm, theta);
+        real best = theta, bestError = e;
+
+        if (e <= cfg.forceError) {
+            // Within budget: open fewer nodes while it stays that way
+            for (int k = 0; k < kMaxProbes && best < kMax; ++k) {
+                const real next = std::min(best * real(1.25), kMax);
+                e = measure(tree, ps, cfg, fmm, next);
+                if (e > cfg.forceError) break;
+                best = next; bestError = e;
+            }
+        } else {
+            // Over budget: tighten until it fits or the lower limit is reached
+            while (best > kMin) {
+                best = std::max(best * real(0.8), kMin);
+                bestError = measure(tree, ps, cfg, fmm, best);
+                if (bestError <= cfg.forceError) break;
+            }
+        }
+
+        error = bestError;
+        met = bestError <= cfg.forceError;
+        return best;
+    }
+
+private:
+    std::vector<int> sample;
+    int targetEnd = 0;
+    std::vector<real> ex, ey, ez;               // Reference accelerations of the sample
+    DirectSum direct;                           // Sources of the reference sum
+
+    void pickSample(int start, int end, int k, uint64_t seed) {
+        sample.clear();
+        const int n = end - start;
+        if (n <= 0) return;
+        std::mt19937_64 rng(seed);
+        k = std::min(std::max(k, 1), n);
+        for (int s = 0; s < k; ++s)
+            sample.push_back(start + static_cast<int>(rng() % static_cast<uint64_t>(n)));
+    }
+
+    /**
+     * @brief RMS relative force error of the sample with the configured solver at 'theta'.
+     */
+    real measure(const Octree& tree, ParticleSystem& ps, const GravityConfig& cfg, Fmm& fmm, real theta) {
+        const int K = static_cast<int>(sample.size());
+        std::vector<real> ax(K, 0), ay(K, 0), az(K, 0);
+
+        if (cfg.solver == GravitySolver::BarnesHut && cfg.walk == TreeWalk::Particle) {
+            #pragma omp parallel
+            {
+                InteractionList pp, pc;
+                std::vector<int> stack;
+                #pragma omp for schedule(dynamic, 1)
+                for (int s = 0; s < K; ++s)
+                    listAccel(tree, sample[s], ps, theta, pp, pc, stack, ax[s], ay[s], az[s]);
+            }
+        } else {
+            // The group walk and the FMM only evaluate the sample, but write into ps
+            const int N = targetEnd;
+            std::vector<unsigned char> mask(ps.size(), 0);
+            std::vector<real> keep(4 * K);
+            const bool hasCost = static_cast<int>(ps.cost.size()) >= N;
+            for (int s = 0; s < K; ++s) {
+                const int i = sample[s];
+                mask[i] = 1;
+                keep[4 * s] = ps.ax[i]; keep[4 * s + 1] = ps.ay[i]; keep[4 * s + 2] = ps.az[i];
+                keep[4 * s + 3] = hasCost ? ps.cost[i] : real(0);
+            }
+            if (cfg.solver == GravitySolver::Fmm) fmm.accel(tree, ps, theta, 0, N, &mask);
+            else groupAccel(tree, ps, theta, cfg.groupSize, 0, N, &mask);
+
+            for (int s = 0; s < K; ++s) {
+                const int i = sample[s];
+                ax[s] = ps.ax[i]; ay[s] = ps.ay[i]; az[s] = ps.az[i];
+            }
+            // Restored in reverse, so a target drawn twice gets its original values back
+            for (int s = K - 1; s >= 0; --s) {
+                const int i = sample[s];
+                ps.ax[i] = keep[4 * s]; ps.ay[i] = keep[4 * s + 1]; ps.az[i] = keep[4 * s + 2];
+                if (hasCost) ps.cost[i] = keep[4 * s + 3];
+            }
+        }
+
+        double sums[2] = { 0.0, static_cast<double>(K) };
+        for (int s = 0; s < K; ++s) {
+            const double dx = ax[s] - ex[s], dy = ay[s] - ey[s], dz = az[s] - ez[s];
+            const double a2 = double(ex[s]) * ex[s] + double(ey[s]) * ey[s] + double(ez[s]) * ez[s];
+            if (a2 > 0) sums[0] += (dx * dx + dy * dy + dz * dz) / a2;
+        }
+#ifdef NEXT_MPI
+        MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        return sums[1] > 0 ? static_cast<real>(std::sqrt(sums[0] / sums[1])) : real(0);
+    }
+};
@@ -0,0 +1,176 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "mapped_file.h"
+#include "struct/particle.h"
+#include "floatdef.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+  #include <io.h>
+#else
+  #include <unistd.h>
+#endif
+
+/**
+ * @brief Simulation state next to the particles that a restart has to pick up.
+ */
+struct RunState {
+    double simTime = 0;
+    double nextDump = 0;
+    long long steps = 0;        // Main-loop iterations so far
+    long long dumps = 0;        // Snapshots written so far
+    long long stepCount = 0;    // stepState().stepCount: drives the reorder and re-tuning schedule
+    double theta = 0;           // Tuned opening angle, 0 if not tuned yet
+    double mapWindow[4] = { 0, 0, 0, 0 };   // ProjectionMaps window: center and half-width, 0 = not fitted yet
+};
+
+/**
+ * @brief Fixed-size header of a checkpoint file. The lanes follow in Particle::forEachLane()
+ * order, each as an element count, an element size and the raw elements, so a lane added
+ * there is checkpointed without touching this file. Files are in the native byte order.
+ */
+struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t realBytes;         // sizeof(real) of the writer; restarts need the same precision
+    int32_t rank, ranks;        // One file per rank; restarts need the same rank count
+    uint32_t lanes;
+    uint32_t accValid;
+    uint64_t count;
+    double simTime, nextDump, theta;
+    int64_t steps, dumps, stepCount;
+    double mapWindow[4];
+};
+
+constexpr char kCheckpointMagic[8] = { 'N', 'E', 'X', 'T', 'C', 'K', 'P', 'T' };
+constexpr uint32_t kCheckpointVersion = 2;
+
+/**
+ * @brief File of one rank's piece of checkpoint 'base': base.nck, or base_rank<r>.nck under MPI.
+ */
+inline std::string CheckpointPath(const std::string& base, int rank, int ranks) {
+    return ranks > 1 ? base + "_rank" + std::to_string(rank) + ".nck" : base + ".nck";
+}
+
+/**
+ * @brief Writes the exact particle state and 'run' to 'path'.
+ * The data goes to path.tmp, is flushed to the disk, and then renamed over 'path', so a crash
+ * while writing leaves the previous checkpoint intact. Returns the bytes written; throws
+ * std::runtime_error on failure.
+ */
+inline long long WriteCheckpoint(Particle& p, const RunState& run, int rank, int ranks, const std::string& path) {
+    const std::string tmp = path + ".tmp";
+    FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) throw std::runtime_error("Cannot create " + tmp);
+    std::setvbuf(f, nullptr, _IOFBF, size_t(1) << 22);
+
+    CheckpointHeader h{};
+    std::memcpy(h.magic, kCheckpointMagic, sizeof(h.magic));
+    h.version = kCheckpointVersion;
+    h.realBytes = sizeof(real);
+    h.rank = rank;
+    h.ranks = ranks;
+    p.forEachLane([&](auto&) { ++h.lanes; });
+    h.accValid = p.accValid ? 1 : 0;
+    h.count = p.size();
+    h.simTime = run.simTime;
+    h.nextDump = run.nextDump;
+    h.theta = run.theta;
+    h.steps = run.steps;
+    h.dumps = run.dumps;
+    h.stepCount = run.stepCount;
+    std::copy(run.mapWindow, run.mapWindow + 4, h.mapWindow);
+
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+    long long bytes = sizeof(h);
+    p.forEachLane([&](auto& lane) {
+        const uint64_t info[2] = { lane.size(), sizeof(lane[0]) };
+        ok = ok && std::fwrite(info, sizeof(info), 1, f) == 1;
+        ok = ok && (lane.empty() || std::fwrite(lane.data(), sizeof(lane[0]), lane.size(), f) == lane.size());
+        bytes += sizeof(info) + lane.size() * sizeof(lane[0]);
+    });
+
+    ok = std::fflush(f) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && ::fsync(fileno(f)) == 0;
+#endif
+    ok = std::fclose(f) == 0 && ok;
+
+    std::error_code ec;
+    if (ok) std::filesystem::rename(tmp, path, ec);
+    if (!ok || ec) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Cannot write " + path);
+    }
+    return bytes;
+}
+
+/**
+ * @brief Restores the particles and the run state written by WriteCheckpoint().
+ * The file is memory-mapped and every lane is copied out in one piece. Throws
+ * std::runtime_error if the file is not a checkpoint of this precision and rank layout.
+ */
+inline Particle ReadCheckpoint(const std::string& path, int rank, int ranks, RunState& run) {
+    MappedFile file(path);
+    const char* data = file.data();
+    const size_t size = file.size();
+
+    CheckpointHeader h;
+    if (size < sizeof(h)) throw std::runtime_error(path + " is not a checkpoint");
+    std::memcpy(&h, data, sizeof(h));
+    if (std::memcmp(h.magic, kCheckpointMagic, sizeof(h.magic)) != 0 || h.version != kCheckpointVersion)
+        throw std::runtime_error(path + " is not a checkpoint");
+    if (h.realBytes != sizeof(real))
+        throw std::runtime_error(path + " was written with " + std::to_string(8 * h.realBytes) +
+                                 "-bit state; rebuild with the same precision to restart from it");
+    if (h.rank != rank || h.ranks != ranks)
+        throw std::runtime_error(path + " is piece " + std::to_string(h.rank) + " of " +
+                                 std::to_string(h.ranks) + "; restart with " + std::to_string(h.ranks) + " ranks");
+
+    Particle p;
+    uint32_t lanes = 0;
+    size_t offset = sizeof(h);
+    bool ok = true;
+    p.forEachLane([&](auto& lane) {
+        uint64_t info[2] = { 0, 0 };
+        if (!ok || offset + sizeof(info) > size) { ok = false; return; }
+        std::memcpy(info, data + offset, sizeof(info));
+        offset += sizeof(info);
+        const uint64_t bytes = info[0] * info[1];
+        if (info[1] != sizeof(lane[0]) || bytes > size - offset) { ok = false; return; }
+        lane.resize(info[0]);
+        if (bytes > 0) std::memcpy(lane.data(), data + offset, bytes);
+        offset += bytes;
+        ++lanes;
+    });
+    if (!ok || lanes != h.lanes || offset != size || p.size() != h.count)
+        throw std::runtime_error(path + " is truncated or from a different NEXT version");
+
+    p.accValid = h.accValid != 0;
+    run.simTime = h.simTime;
+    run.nextDump = h.nextDump;
+    run.theta = h.theta;
+    run.steps = h.steps;
+    run.dumps = h.dumps;
+    run.stepCount = h.stepCount;
+    std::copy(h.mapWindow, h.mapWindow + 4, run.mapWindow);
+    return p;
+}
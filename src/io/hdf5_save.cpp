@@ -9,12 +9,40 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include "hdf5_save.h"
 #include "struct/particle.h"
 #include <hdf5.h>
 #include <vector>
 #include <string>
 #include <fstream>
 #include <iostream>
+#ifdef NEXT_PARALLEL_HDF5
+    #include <mpi.h>
+#endif
+
+/**
+ * @brief Writes the XDMF description of a snapshot written by SaveHDF5 (N particles in total),
+ * so ParaView can open the HDF5 file as a point cloud.
+ */
+static void WriteXdmf(const std::string& filename, unsigned long long N, int precision)
+{
+    std::string xdmf_filename = filename.substr(0, filename.find_last_of('.')) + ".xdmf";
+    std::ofstream xmf(xdmf_filename);
+    xmf << "<?xml version=\"1.0\" ?>\n<Xdmf Version=\"3.0\">\n  <Domain>\n";
+    xmf << "    <Grid Name=\"Particles\" GridType=\"Uniform\">\n";
+    xmf << "      <Topology TopologyType=\"Polyvertex\" NumberOfElements=\"" << N << "\"/>\n";
+    xmf << "      <Geometry GeometryType=\"XYZ\">\n";
+    xmf << "        <DataItem Dimensions=\"" << N << " 3\" NumberType=\"Float\" Precision=\"4\" Format=\"HDF\">\n";
+    xmf << "          " << filename << ":/PartType1/Coordinates\n";
+    xmf << "        </DataItem>\n      </Geometry>\n";
+    xmf << "      <Attribute Name=\"Mass\" AttributeType=\"Scalar\" Center=\"Node\">\n";
+    // We dynamically set the precision here to match the file
+    xmf << "        <DataItem Dimensions=\"" << N << "\" NumberType=\"Float\" Precision=\"" << precision << "\" Format=\"HDF\">\n";
+    xmf << "          " << filename << ":/PartType1/Masses\n";
+    xmf << "        </DataItem>\n      </Attribute>\n";
+    xmf << "    </Grid>\n  </Domain>\n</Xdmf>\n";
+    xmf.close();
+}
 
 /**
  * @brief Saves the ParticleSystem to HDF5. 
@@ -34,7 +62,6 @@ void SaveHDF5(const ParticleSystem& ps, const std::string& filename)
     // We keep these as float for visualization efficiency (ParaView rarely needs double)
     std::vector<float> coords(N * 3);
     std::vector<float> vels(N * 3);
-    std::vector<int> ids(N);
 
     #pragma omp parallel for
     for (size_t i = 0; i < N; i++) {
@@ -44,7 +71,6 @@ void SaveHDF5(const ParticleSystem& ps, const std::string& filename)
         vels[3*i+0]   = (float)ps.vx[i];
         vels[3*i+1]   = (float)ps.vy[i];
         vels[3*i+2]   = (float)ps.vz[i];
-        ids[i] = (int)i + 1;
     }
 
     hsize_t dims3[2] = { N, 3 };
@@ -70,8 +96,9 @@ void SaveHDF5(const ParticleSystem& ps, const std::string& filename)
     H5Dwrite(dset_masses, h5_real_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, ps.m.data());
     H5Dclose(dset_masses);
 
-    hid_t dset_ids = H5Dcreate(group, "ParticleIDs", H5T_NATIVE_INT, space1, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
-    H5Dwrite(dset_ids, H5T_NATIVE_INT, H5S_ALL, H5S_ALL, H5P_DEFAULT, ids.data());
+    // Persistent IDs, so particles can be followed across dumps even though Step() reorders them
+    hid_t dset_ids = H5Dcreate(group, "ParticleIDs", H5T_NATIVE_UINT64, space1, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Dwrite(dset_ids, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT, ps.id.data());
     H5Dclose(dset_ids);
 
     H5Sclose(space3);
@@ -80,20 +107,84 @@ void SaveHDF5(const ParticleSystem& ps, const std::string& filename)
     H5Fclose(file);
 
     // --- XDMF SIDECAR ---
-    std::string xdmf_filename = filename.substr(0, filename.find_last_of('.')) + ".xdmf";
-    std::ofstream xmf(xdmf_filename);
-    xmf << "<?xml version=\"1.0\" ?>\n<Xdmf Version=\"3.0\">\n  <Domain>\n";
-    xmf << "    <Grid Name=\"Particles\" GridType=\"Uniform\">\n";
-    xmf << "      <Topology TopologyType=\"Polyvertex\" NumberOfElements=\"" << N << "\"/>\n";
-    xmf << "      <Geometry GeometryType=\"XYZ\">\n";
-    xmf << "        <DataItem Dimensions=\"" << N << " 3\" NumberType=\"Float\" Precision=\"4\" Format=\"HDF\">\n";
-    xmf << "          " << filename << ":/PartType1/Coordinates\n";
-    xmf << "        </DataItem>\n      </Geometry>\n";
-    xmf << "      <Attribute Name=\"Mass\" AttributeType=\"Scalar\" Center=\"Node\">\n";
-    // We dynamically set the precision here to match the file
-    xmf << "        <DataItem Dimensions=\"" << N << "\" NumberType=\"Float\" Precision=\"" << precision << "\" Format=\"HDF\">\n";
-    xmf << "          " << filename << ":/PartType1/Masses\n";
-    xmf << "        </DataItem>\n      </Attribute>\n";
-    xmf << "    </Grid>\n  </Domain>\n</Xdmf>\n";
-    xmf.close();
+    WriteXdmf(filename, N, precision);
+}
+
+#ifdef NEXT_PARALLEL_HDF5
+void SaveHDF5Parallel(const ParticleSystem& ps, const std::string& filename)
+{
+    int rank = 0, ranks = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+    // Slice of this rank in the global datasets
+    const unsigned long long n = ps.size();
+    unsigned long long offset = 0, total = 0;
+    MPI_Exscan(&n, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) offset = 0;   // MPI_Exscan leaves rank 0's result undefined
+    MPI_Allreduce(&n, &total, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (total == 0) return;
+
+    hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(fapl, MPI_COMM_WORLD, MPI_INFO_NULL);
+    hid_t file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+    H5Pclose(fapl);
+    if (file < 0) return;
+
+    hid_t group = H5Gcreate(file, "PartType1", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t dxpl = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(dxpl, H5FD_MPIO_COLLECTIVE);
+
+    // Same layout as SaveHDF5: float32 coordinates and velocities, masses in 'real'
+    std::vector<float> coords(n * 3);
+    std::vector<float> vels(n * 3);
+
+    #pragma omp parallel for
+    for (long long i = 0; i < static_cast<long long>(n); i++) {
+        coords[3*i+0] = (float)ps.x[i];
+        coords[3*i+1] = (float)ps.y[i];
+        coords[3*i+2] = (float)ps.z[i];
+        vels[3*i+0]   = (float)ps.vx[i];
+        vels[3*i+1]   = (float)ps.vy[i];
+        vels[3*i+2]   = (float)ps.vz[i];
+    }
+
+    hid_t h5_real_type = (sizeof(real) == 4) ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+    int precision = (sizeof(real) == 4) ? 4 : 8;
+
+    // Creates the global dataset and writes this rank's rows [offset, offset + n) collectively.
+    // Every rank takes part in every call, also with an empty slice.
+    auto writeSlice = [&](const char* name, hid_t type, int columns, const void* data) {
+        hsize_t dims[2] = { total, hsize_t(columns) };
+        hsize_t start[2] = { offset, 0 };
+        hsize_t count[2] = { n, hsize_t(columns) };
+        const int rankDims = (columns > 1) ? 2 : 1;
+
+        hid_t filespace = H5Screate_simple(rankDims, dims, NULL);
+        hid_t dset = H5Dcreate(group, name, type, filespace, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t memspace = H5Screate_simple(rankDims, count, NULL);
+        if (n > 0) {
+            H5Sselect_hyperslab(filespace, H5S_SELECT_SET, start, NULL, count, NULL);
+        } else {
+            H5Sselect_none(filespace);
+            H5Sselect_none(memspace);
+        }
+        H5Dwrite(dset, type, memspace, filespace, dxpl, data);
+
+        H5Sclose(memspace);
+        H5Dclose(dset);
+        H5Sclose(filespace);
+    };
+
+    writeSlice("Coordinates", H5T_NATIVE_FLOAT, 3, coords.data());
+    writeSlice("Velocities", H5T_NATIVE_FLOAT, 3, vels.data());
+    writeSlice("Masses", h5_real_type, 1, ps.m.data());
+    writeSlice("ParticleIDs", H5T_NATIVE_UINT64, 1, ps.id.data());
+
+    H5Pclose(dxpl);
+    H5Gclose(group);
+    H5Fclose(file);
+
+    if (rank == 0) WriteXdmf(filename, total, precision);
 }
+#endif
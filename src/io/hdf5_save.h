@@ -1,5 +1,21 @@
 #pragma once
 #include <string>
+#include <hdf5.h>
 #include "../struct/particle.h"
 
+// MPI builds against an HDF5 library built with MPI-IO write one shared file per dump
+#if defined(NEXT_MPI) && defined(H5_HAVE_PARALLEL)
+    #define NEXT_PARALLEL_HDF5
+#endif
+
 void SaveHDF5(const ParticleSystem& ps, const std::string& filename);
+
+#ifdef NEXT_PARALLEL_HDF5
+/**
+ * @brief Collective version of SaveHDF5: every rank calls it with its own particles and the
+ * same filename. The datasets hold the particles of all ranks, rank r's slice starting after
+ * those of ranks 0..r-1; each rank writes its slice through a hyperslab selection in one
+ * collective MPI-IO write per dataset. Rank 0 writes the XDMF sidecar.
+ */
+void SaveHDF5Parallel(const ParticleSystem& ps, const std::string& filename);
+#endif
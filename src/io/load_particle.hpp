@@ -11,107 +11,161 @@
 
 #include "struct/particle.h"
 #include "floatdef.h"
-#include <fstream>
+#include "text_loader.h"
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <stdexcept>
 #include <hdf5.h>
 
 /**
- * @brief Helper: load one PartType group from HDF5 into the SoA Particle database.
+ * @brief Rows of one HDF5 dataset to be read into particle lanes.
+ * Datasets are (N x 3) for vectors, read into three 'real' lanes, and (N) for scalars, read
+ * into out[0] as memType.
  */
-void LoadPartType(hid_t file,
-                  const std::string& group,
-                  int internalType,
-                  Particle& p) // p is now the SoA container
+struct H5DatasetRead {
+    std::string path;
+    int width;          // 3 for vectors, 1 for scalars
+    hid_t memType;      // HDF5 converts from the file's type to this one while reading
+    size_t elemSize;
+    hsize_t first, count;
+    void* out[3];
+};
+
+/**
+ * @brief Reads rows [first, first + count) of a dataset in contiguous slabs of kRows rows.
+ * Scalars go straight into their lane. Vector slabs land in 'scratch' (at most kRows x 3
+ * elements, reused between calls) and are scattered into the three lanes, so each byte of the
+ * file is read once and the memory stays bounded. Returns false if the dataset cannot be read.
+ */
+inline bool ReadH5Dataset(hid_t file, const H5DatasetRead& r, std::vector<real>& scratch)
+{
+    constexpr hsize_t kRows = hsize_t(1) << 18;
+
+    hid_t dset = H5Dopen(file, r.path.c_str(), H5P_DEFAULT);
+    if (dset < 0) return false;
+    hid_t space = H5Dget_space(dset);
+    if (r.width > 1) scratch.resize(size_t(std::min(kRows, r.count)) * r.width);
+
+    bool ok = true;
+    for (hsize_t done = 0; done < r.count && ok; done += kRows) {
+        const hsize_t n = std::min(kRows, r.count - done);
+        hsize_t start[2] = { r.first + done, 0 };
+        hsize_t count[2] = { n, hsize_t(r.width) };
+        H5Sselect_hyperslab(space, H5S_SELECT_SET, start, NULL, count, NULL);
+        hid_t mem = H5Screate_simple(r.width > 1 ? 2 : 1, count, NULL);
+        void* dst = r.width > 1 ? static_cast<void*>(scratch.data()) : static_cast<char*>(r.out[0]) + done * r.elemSize;
+        ok = H5Dread(dset, r.memType, mem, space, H5P_DEFAULT, dst) >= 0;
+        H5Sclose(mem);
+        if (!ok || r.width == 1) continue;
+
+        // Row-major (x, y, z) triples into the lanes
+        for (int c = 0; c < r.width; ++c) {
+            real* lane = static_cast<real*>(r.out[c]) + done;
+            for (hsize_t k = 0; k < n; ++k) lane[k] = scratch[k * r.width + c];
+        }
+    }
+
+    H5Sclose(space);
+    H5Dclose(dset);
+    return ok;
+}
+
+/**
+ * @brief Number of particles in one PartType group (rows of its Coordinates), 0 if it is absent.
+ */
+inline size_t H5PartRows(hid_t file, const std::string& group)
+{
+    const std::string coords = group + "/Coordinates";
+    if (H5Lexists(file, group.c_str(), H5P_DEFAULT) <= 0 || H5Lexists(file, coords.c_str(), H5P_DEFAULT) <= 0)
+        return 0;
+    hid_t dset = H5Dopen(file, coords.c_str(), H5P_DEFAULT);
+    hid_t space = H5Dget_space(dset);
+    hsize_t dims[2] = { 0, 0 };
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    H5Sclose(space);
+    H5Dclose(dset);
+    return dims[0];
+}
+
+/**
+ * @brief Loads particles [first, last) of an HDF5 snapshot (PartType1 = Dark Matter, then
+ * PartType4 = Stars) into p. The lanes are sized once and every dataset is read once, in
+ * contiguous slabs converted to the precision of 'real' (see ReadH5Dataset).
+ */
+inline void LoadHDF5Slice(hid_t file, size_t first, size_t last, Particle& p)
 {
-    // Coordinates Check
-    if (H5Lexists(file, (group + "/Coordinates").c_str(), H5P_DEFAULT) <= 0)
-        return;
-
-    hid_t dset_coords = H5Dopen(file, (group + "/Coordinates").c_str(), H5P_DEFAULT);
-    hid_t space_coords = H5Dget_space(dset_coords);
-
-    hsize_t dims[2];
-    H5Sget_simple_extent_dims(space_coords, dims, NULL);
-    size_t N = dims[0]; 
-
-    // Temporary buffers for HDF5 read
-    std::vector<float> coords(N * 3);
-    std::vector<float> vels(N * 3);
-    std::vector<float> masses(N);
-
-    // Read everything from HDF5
-    H5Dread(dset_coords, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, coords.data());
-    
-    hid_t dset_vels = H5Dopen(file, (group + "/Velocities").c_str(), H5P_DEFAULT);
-    H5Dread(dset_vels, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, vels.data());
-    
-    hid_t dset_masses = H5Dopen(file, (group + "/Masses").c_str(), H5P_DEFAULT);
-    H5Dread(dset_masses, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, masses.data());
-
-    // --- RE-FILL SoA LANES ---
-    // We reserve space to avoid multiple reallocations
-    size_t current_size = p.x.size();
-    p.x.resize(current_size + N);
-    p.y.resize(current_size + N);
-    p.z.resize(current_size + N);
-    p.vx.resize(current_size + N);
-    p.vy.resize(current_size + N);
-    p.vz.resize(current_size + N);
-    p.m.resize(current_size + N);
-    p.type.resize(current_size + N);
-
-    for (size_t i = 0; i < N; i++) {
-        size_t idx = current_size + i;
-        p.x[idx]  = coords[3*i+0];
-        p.y[idx]  = coords[3*i+1];
-        p.z[idx]  = coords[3*i+2];
-        p.vx[idx] = vels[3*i+0];
-        p.vy[idx] = vels[3*i+1];
-        p.vz[idx] = vels[3*i+2];
-        p.m[idx]  = masses[i];
-        p.type[idx] = internalType;
+    struct Part { const char* group; int type; size_t n; };
+    Part parts[] = { { "PartType1", 1, 0 }, { "PartType4", 0, 0 } };
+    for (Part& part : parts) part.n = H5PartRows(file, part.group);
+
+    const size_t n = last - first;
+    p.clear();
+    p.x.resize(n); p.y.resize(n); p.z.resize(n);
+    p.vx.resize(n, 0); p.vy.resize(n, 0); p.vz.resize(n, 0);
+    p.ax.assign(n, 0); p.ay.assign(n, 0); p.az.assign(n, 0);
+    p.m.resize(n); p.type.resize(n); p.id.assign(n, 0);
+
+    const hid_t realType = (sizeof(real) == 4) ? H5T_NATIVE_FLOAT : H5T_NATIVE_DOUBLE;
+    std::vector<H5DatasetRead> reads;
+    size_t partStart = 0, dest = 0;
+    for (const Part& part : parts) {
+        // Overlap of this part type with the requested slice
+        const size_t s = std::max(first, partStart), e = std::min(last, partStart + part.n);
+        partStart += part.n;
+        if (s >= e) continue;
+
+        const hsize_t row = s - (partStart - part.n), count = e - s;
+        const std::string g = part.group;
+        std::fill(p.type.begin() + dest, p.type.begin() + dest + count, part.type);
+
+        reads.push_back({ g + "/Coordinates", 3, realType, sizeof(real), row, count,
+                          { p.x.data() + dest, p.y.data() + dest, p.z.data() + dest } });
+        if (H5Lexists(file, (g + "/Velocities").c_str(), H5P_DEFAULT) > 0) {
+            reads.push_back({ g + "/Velocities", 3, realType, sizeof(real), row, count,
+                              { p.vx.data() + dest, p.vy.data() + dest, p.vz.data() + dest } });
+        }
+        reads.push_back({ g + "/Masses", 1, realType, sizeof(real), row, count, { p.m.data() + dest } });
+        // Keep IDs from the file so particles stay traceable across runs; missing ones stay 0
+        if (H5Lexists(file, (g + "/ParticleIDs").c_str(), H5P_DEFAULT) > 0)
+            reads.push_back({ g + "/ParticleIDs", 1, H5T_NATIVE_UINT64, sizeof(uint64_t), row, count, { p.id.data() + dest } });
+        dest += count;
     }
 
-    // Cleanup
-    H5Dclose(dset_coords);
-    H5Dclose(dset_vels);
-    H5Dclose(dset_masses);
-    H5Sclose(space_coords);
+    std::vector<real> scratch;
+    for (const H5DatasetRead& r : reads) {
+        if (!ReadH5Dataset(file, r, scratch))
+            throw std::runtime_error("Cannot read " + r.path + " from the HDF5 file");
+    }
 }
 
 /**
  * @brief Loads the Particle database from file.
+ * With parts > 1 only share 'part' of the particles is kept (the same split as the MPI ranks
+ * use), and IDs missing from the file are left 0 for assignGlobalIds(); otherwise they are
+ * assigned here.
  */
-Particle LoadParticlesFromFile(const std::string& filename)
+Particle LoadParticlesFromFile(const std::string& filename, int part = 0, int parts = 1)
 {
     Particle p; // The SoA container
 
     // --- Try HDF5 first ---
     hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
     if (file >= 0) {
-        LoadPartType(file, "PartType1", 1, p); // DM
-        LoadPartType(file, "PartType4", 0, p); // Stars
+        const size_t N = H5PartRows(file, "PartType1") + H5PartRows(file, "PartType4");
+        try {
+            LoadHDF5Slice(file, (N * part) / parts, (N * (part + 1)) / parts, p);
+        } catch (...) {
+            H5Fclose(file);
+            throw;
+        }
         H5Fclose(file);
+        if (parts == 1) p.assignIds();
         return p;
     }
 
     // --- Fallback: plain text loader ---
-    std::ifstream in(filename);
-    real tx, ty, tz, tvx, tvy, tvz, tm;
-    int tt;
-    
-    // Read column by column and push into SoA lanes
-    while (in >> tx >> ty >> tz >> tvx >> tvy >> tvz >> tm >> tt) {
-        p.x.push_back(tx);
-        p.y.push_back(ty);
-        p.z.push_back(tz);
-        p.vx.push_back(tvx);
-        p.vy.push_back(tvy);
-        p.vz.push_back(tvz);
-        p.m.push_back(tm);
-        p.type.push_back(tt);
-    }
+    p = LoadTextParticles(filename, part, parts);
+    if (parts == 1) p.assignIds();
     return p;
 }
@@ -0,0 +1,179 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "gravity/step.h"
+#include "struct/particle.h"
+#include "floatdef.h"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#ifdef NEXT_MPI
+  #include <mpi.h>
+#endif
+
+/**
+ * @brief What a level-of-detail snapshot keeps.
+ * Tree nodes become pseudo-particles at depth maxDepth or once their mass is at most maxMass,
+ * whichever comes first (0 disables a criterion). Nodes that touch the region of interest, the
+ * cube of half-width roiHalf around (roiX, roiY, roiZ), are opened down to the particles.
+ */
+struct LodConfig {
+    int maxDepth = 0;
+    real maxMass = 0;
+    real roiX = 0, roiY = 0, roiZ = 0;
+    real roiHalf = -1;          // < 0: no region of interest
+
+    bool enabled() const { return maxDepth > 0 || maxMass > real(0); }
+};
+
+/**
+ * @brief Builds level-of-detail copies of the particles from the octree.
+ * Every selected node is replaced by one pseudo-particle per particle type below it, with the
+ * mass, center of mass and mass-weighted mean velocity of those particles and ID 0. Selected
+ * leaves and everything in the region of interest are copied as they are, IDs included.
+ * The tree of the last step is used when it still matches the particles; otherwise (direct
+ * summation, restarts) a tree is built here, without disturbing the one the steps refit.
+ */
+class LodBuilder {
+public:
+    explicit LodBuilder(const LodConfig& cfg) : cfg(cfg) {}
+
+    /**
+     * @brief Level-of-detail copy of ps. Collective under MPI; each rank reduces its own particles.
+     */
+    const Particle& build(const Particle& ps) {
+        const StepState& st = stepState();
+        int current = !st.treeStale && !st.tree.empty() &&
+                      st.tree.nodes[0].count == static_cast<int>(ps.size());
+#ifdef NEXT_MPI
+        // Building a tree is collective, so either every rank reuses its tree or none does
+        MPI_Allreduce(MPI_IN_PLACE, &current, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+#endif
+        if (!current) buildTree(own, ps);
+        const Octree& tree = current ? st.tree : own;
+
+        types = 1;
+        for (int t : ps.type) types = std::max(types, t + 1);
+
+        select(tree);
+        reduce(tree, ps);
+        return out;
+    }
+
+private:
+    /** @brief Sums of the particles of one type below a selected node. */
+    struct Moments {
+        double m = 0, x = 0, y = 0, z = 0, vx = 0, vy = 0, vz = 0;
+        long long count = 0;
+    };
+
+    LodConfig cfg;
+    Octree own;
+    Particle out;
+    int types = 1;
+    std::vector<int> picked;        // Selected nodes
+    std::vector<Moments> sums;      // picked.size() x types
+
+    /**
+     * @brief Collects the nodes that end up in the snapshot, in depth-first order.
+     */
+    void select(const Octree& tree) {
+        picked.clear();
+        if (tree.empty()) return;
+
+        std::vector<std::pair<int, int>> stack{ { 0, 0 } };    // (node, depth)
+        while (!stack.empty()) {
+            const auto [n, depth] = stack.back();
+            stack.pop_back();
+            const OctreeNode& node = tree.nodes[n];
+            if (node.count == 0) continue;
+
+            const bool coarse = (cfg.maxDepth > 0 && depth >= cfg.maxDepth) ||
+                                (cfg.maxMass > real(0) && real(node.m) <= cfg.maxMass);
+            if (node.leaf || (coarse && !inRegion(node))) {
+                picked.push_back(n);
+                continue;
+            }
+            // Reversed, so the children come off the stack in octant order
+            for (int c = 7; c >= 0; --c) {
+                if (node.child[c] >= 0) stack.push_back({ node.child[c], depth + 1 });
+            }
+        }
+    }
+
+    /**
+     * @brief True if the node's particles may lie inside the region of interest.
+     * 'size' is the half-width around the geometric center that covers all of them, also after refits.
+     */
+    bool inRegion(const OctreeNode& node) const {
+        if (cfg.roiHalf < real(0)) return false;
+        const real reach = cfg.roiHalf + real(node.size);
+        return std::abs(node.x - cfg.roiX) <= reach &&
+               std::abs(node.y - cfg.roiY) <= reach &&
+               std::abs(node.z - cfg.roiZ) <= reach;
+    }
+
+    /**
+     * @brief Sums every selected subtree per type and writes the pseudo-particles to 'out'.
+     */
+    void reduce(const Octree& tree, const Particle& ps) {
+        const int P = static_cast<int>(picked.size());
+        sums.assign(size_t(P) * types, Moments{});
+
+        #pragma omp parallel
+        {
+            std::vector<int> stack;
+            #pragma omp for schedule(dynamic, 64)
+            for (int k = 0; k < P; ++k) {
+                if (tree.nodes[picked[k]].leaf) continue;    // Copied as it is below
+                Moments* s = &sums[size_t(k) * types];
+                stack.assign(1, picked[k]);
+                while (!stack.empty()) {
+                    const OctreeNode& node = tree.nodes[stack.back()];
+                    stack.pop_back();
+                    if (!node.leaf) {
+                        for (int c : node.child) if (c >= 0) stack.push_back(c);
+                        continue;
+                    }
+                    const int i = node.bodyIdx;
+                    if (i < 0) continue;
+                    Moments& t = s[std::max(ps.type[i], 0)];    // Invalid negative types count as type 0
+                    const double m = double(ps.m[i]);
+                    t.m += m;
+                    t.x += m * ps.x[i];   t.y += m * ps.y[i];   t.z += m * ps.z[i];
+                    t.vx += m * ps.vx[i]; t.vy += m * ps.vy[i]; t.vz += m * ps.vz[i];
+                    ++t.count;
+                }
+            }
+        }
+
+        out.clear();
+        for (int k = 0; k < P; ++k) {
+            const OctreeNode& node = tree.nodes[picked[k]];
+            if (node.leaf) {
+                const int i = node.bodyIdx;
+                out.addParticle(ps.x[i], ps.y[i], ps.z[i], ps.vx[i], ps.vy[i], ps.vz[i], ps.m[i], ps.type[i]);
+                out.id.back() = ps.id.empty() ? 0 : ps.id[i];
+                continue;
+            }
+            for (int t = 0; t < types; ++t) {
+                const Moments& s = sums[size_t(k) * types + t];
+                if (s.count == 0) continue;
+                // Massless particles have no center of mass; they get the node's
+                const double w = s.m > 0 ? 1.0 / s.m : 0.0;
+                out.addParticle(s.m > 0 ? real(s.x * w) : node.cx, s.m > 0 ? real(s.y * w) : node.cy,
+                                s.m > 0 ? real(s.z * w) : node.cz,
+                                real(s.vx * w), real(s.vy * w), real(s.vz * w), real(s.m), t);
+            }
+        }
+    }
+};
@@ -0,0 +1,267 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "gravity/octree.h"
+#include "struct/particle.h"
+#include "floatdef.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+#ifdef NEXT_MPI
+  #include "parallel/domain.h"
+  #include <mpi.h>
+#endif
+
+/**
+ * @brief In-situ projected maps: surface density and mass-weighted mean line-of-sight
+ * velocity on square pixel grids, one per projection axis (and per particle type if asked).
+ * Particles are deposited with cloud-in-cell weights. All maps share one fixed square window,
+ * so the frames of a run line up as a movie; with extent 0 it is fitted to the particles the
+ * first time maps are written, and a checkpoint carries the fitted window over a restart
+ * (see window()). Projecting along z maps (x, y), along x (y, z), along y (x, z).
+ *
+ * For each map <name> three files are written by rank 0:
+ *  - <name>.bin: int32 nx, ny; float64 x0, y0 (lower-left corner in the plane), pixel size;
+ *    then nx*ny float32 surface densities and nx*ny float32 velocities, row-major from y0 up;
+ *  - <name>_density.pgm: log10 surface density over the 4 decades below the peak;
+ *  - <name>_velocity.pgm: velocity from -vmax (black) to +vmax (white), empty pixels grey.
+ */
+class ProjectionMaps {
+public:
+    /**
+     * @brief pixels: grid size per side; axes: projection axes out of "xyz" (e.g. "z" or "xyz");
+     * extent: half-width of the window around the origin, 0 = fit; byType: one map per type.
+     */
+    ProjectionMaps(int pixels, const std::string& axes, real extent, bool byType)
+        : n(std::max(pixels, 1)), axes(axes), half(extent), byType(byType) {}
+
+    /**
+     * @brief Deposits the particles and writes the maps of this frame as <base>_<axis>[_type<t>].
+     * Collective under MPI. Returns the bytes written on this rank; files that cannot be written
+     * are reported on stderr and skipped.
+     */
+    long long write(const Particle& ps, const std::string& base) {
+        int rank = 0;
+#ifdef NEXT_MPI
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+        if (half <= real(0)) fit(ps);
+
+        int types = 1;
+        if (byType) {
+            int maxType = 0;
+            for (int t : ps.type) maxType = std::max(maxType, t);
+#ifdef NEXT_MPI
+            MPI_Allreduce(MPI_IN_PLACE, &maxType, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+#endif
+            types = maxType + 1;
+        }
+
+        long long bytes = 0;
+        for (char axis : axes) {
+            for (int t = 0; t < types; ++t) {
+                deposit(ps, axis, byType ? t : -1);
+#ifdef NEXT_MPI
+                MPI_Reduce(rank == 0 ? MPI_IN_PLACE : mass.data(), mass.data(), static_cast<int>(mass.size()),
+                           MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+                MPI_Reduce(rank == 0 ? MPI_IN_PLACE : momentum.data(), momentum.data(), static_cast<int>(momentum.size()),
+                           MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+#endif
+                if (rank != 0) continue;
+                std::string name = base + "_" + axis;
+                if (byType) name += "_type" + std::to_string(t);
+                try {
+                    bytes += save(name);
+                } catch (const std::exception& e) {
+                    // The other ranks are already on the next map; a lost frame is not worth stopping for
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+        return bytes;
+    }
+
+    /** @brief The window as center x, y, z and half-width; the half-width is 0 until fitted. */
+    void window(double w[4]) const {
+        w[0] = cx; w[1] = cy; w[2] = cz;
+        w[3] = half;
+    }
+
+    /** @brief Takes over a window saved by window(), unless this one is fixed already. */
+    void setWindow(const double w[4]) {
+        if (half > real(0) || w[3] <= 0) return;
+        cx = static_cast<real>(w[0]); cy = static_cast<real>(w[1]); cz = static_cast<real>(w[2]);
+        half = static_cast<real>(w[3]);
+    }
+
+private:
+    int n;
+    std::string axes;
+    real half;
+    bool byType;
+    real cx = 0, cy = 0, cz = 0;
+    std::vector<double> mass, momentum;     // Per pixel: mass, and mass times line-of-sight velocity
+    double corner[2] = { 0, 0 };            // Lower-left corner of the current grid in its plane
+    std::vector<double> scratch;            // Per-thread grids of deposit()
+
+    static constexpr size_t kPrivateBytes = size_t(128) << 20;
+
+    /** @brief Centers the window on the particles' bounding box, with a 5% margin. */
+    void fit(const Particle& ps) {
+#ifdef NEXT_MPI
+        const BBox b = globalBounds(ps);
+#else
+        const BBox b = computeBounds(ps);
+#endif
+        if (b.minx > b.maxx) { half = real(1); return; }    // No particles anywhere
+        cx = (b.minx + b.maxx) * real(0.5);
+        cy = (b.miny + b.maxy) * real(0.5);
+        cz = (b.minz + b.maxz) * real(0.5);
+        half = real(0.525) * std::max({ b.maxx - b.minx, b.maxy - b.miny, b.maxz - b.minz, real(1e-10) });
+    }
+
+    /**
+     * @brief Cloud-in-cell deposit of the particles of 'type' (-1 = all) projected along 'axis'.
+     * Every thread fills its own copy of the grids while they fit in kPrivateBytes, and the
+     * copies are summed afterwards. Above that the threads add atomically into one grid, which
+     * collides little because the particles are Morton-ordered most of the time.
+     */
+    void deposit(const Particle& ps, char axis, int type) {
+        const size_t pixels = size_t(n) * n;
+        mass.assign(pixels, 0.0);
+        momentum.assign(pixels, 0.0);
+
+        // Plane coordinates (a, b) and line-of-sight velocity
+        const std::vector<real>& a  = axis == 'x' ? ps.y : ps.x;
+        const std::vector<real>& b  = axis == 'z' ? ps.y : ps.z;
+        const std::vector<real>& vl = axis == 'x' ? ps.vx : axis == 'y' ? ps.vy : ps.vz;
+        const double a0 = double(axis == 'x' ? cy : cx) - double(half);
+        const double b0 = double(axis == 'z' ? cy : cz) - double(half);
+        const double inv = n / (2.0 * double(half));
+        corner[0] = a0;
+        corner[1] = b0;
+
+        auto splat = [&](int i, double* M, double* P, auto atomic) {
+            if (type >= 0 && ps.type[i] != type) return;
+            const double u = (double(a[i]) - a0) * inv - 0.5;
+            const double v = (double(b[i]) - b0) * inv - 0.5;
+            if (!(u > -1.0 && u < n && v > -1.0 && v < n)) return;    // Also drops NaNs
+            const int iu = static_cast<int>(std::floor(u));
+            const int iv = static_cast<int>(std::floor(v));
+            const double fu = u - iu, fv = v - iv;
+            const double w[4] = { (1 - fu) * (1 - fv), fu * (1 - fv), (1 - fu) * fv, fu * fv };
+            const int pu[4] = { iu, iu + 1, iu, iu + 1 };
+            const int pv[4] = { iv, iv, iv + 1, iv + 1 };
+            const double m = double(ps.m[i]), mv = m * double(vl[i]);
+            for (int k = 0; k < 4; ++k) {
+                if (pu[k] < 0 || pu[k] >= n || pv[k] < 0 || pv[k] >= n) continue;
+                const size_t pix = size_t(pv[k]) * n + pu[k];
+                if constexpr (decltype(atomic)::value) {
+                    #pragma omp atomic
+                    M[pix] += w[k] * m;
+                    #pragma omp atomic
+                    P[pix] += w[k] * mv;
+                } else {
+                    M[pix] += w[k] * m;
+                    P[pix] += w[k] * mv;
+                }
+            }
+        };
+
+        const int N = static_cast<int>(ps.size());
+        const int threads = omp_get_max_threads();
+        if (threads == 1) {
+            for (int i = 0; i < N; ++i) splat(i, mass.data(), momentum.data(), std::false_type{});
+        } else if (size_t(threads) * 2 * pixels * sizeof(double) <= kPrivateBytes) {
+            scratch.assign(size_t(threads) * 2 * pixels, 0.0);
+            #pragma omp parallel num_threads(threads)
+            {
+                double* M = scratch.data() + size_t(omp_get_thread_num()) * 2 * pixels;
+                #pragma omp for schedule(static)
+                for (int i = 0; i < N; ++i) splat(i, M, M + pixels, std::false_type{});
+
+                #pragma omp for schedule(static)
+                for (long long k = 0; k < static_cast<long long>(pixels); ++k) {
+                    for (int t = 0; t < threads; ++t) {
+                        mass[k] += scratch[size_t(t) * 2 * pixels + k];
+                        momentum[k] += scratch[size_t(t) * 2 * pixels + pixels + k];
+                    }
+                }
+            }
+        } else {
+            #pragma omp parallel for schedule(static)
+            for (int i = 0; i < N; ++i) splat(i, mass.data(), momentum.data(), std::true_type{});
+        }
+    }
+
+    /** @brief Writes the .bin file and the two PGM previews of the current grids. */
+    long long save(const std::string& name) const {
+        const size_t pixels = size_t(n) * n;
+        const double h = 2.0 * double(half) / n;
+        std::vector<float> sigma(pixels), vel(pixels);
+        float sigmaMax = 0, vMax = 0;
+        for (size_t k = 0; k < pixels; ++k) {
+            sigma[k] = float(mass[k] / (h * h));
+            vel[k] = mass[k] > 0 ? float(momentum[k] / mass[k]) : 0.0f;
+            sigmaMax = std::max(sigmaMax, sigma[k]);
+            vMax = std::max(vMax, std::fabs(vel[k]));
+        }
+
+        std::ofstream bin(name + ".bin", std::ios::binary);
+        if (!bin) throw std::runtime_error("Cannot create " + name + ".bin");
+        const int32_t dims[2] = { n, n };
+        const double geom[3] = { corner[0], corner[1], h };
+        bin.write(reinterpret_cast<const char*>(dims), sizeof(dims));
+        bin.write(reinterpret_cast<const char*>(geom), sizeof(geom));
+        bin.write(reinterpret_cast<const char*>(sigma.data()), pixels * sizeof(float));
+        bin.write(reinterpret_cast<const char*>(vel.data()), pixels * sizeof(float));
+        long long bytes = static_cast<long long>(sizeof(dims) + sizeof(geom) + 2 * pixels * sizeof(float));
+
+        // 8-bit previews; image rows go top-down, so the grid is flipped
+        const double logMax = sigmaMax > 0 ? std::log10(double(sigmaMax)) : 0.0;
+        std::vector<unsigned char> img(pixels);
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                const float s = sigma[size_t(n - 1 - r) * n + c];
+                const double l = s > 0 ? (std::log10(double(s)) - logMax + 4.0) / 4.0 : 0.0;
+                img[size_t(r) * n + c] = static_cast<unsigned char>(255.0 * std::clamp(l, 0.0, 1.0) + 0.5);
+            }
+        }
+        bytes += savePGM(name + "_density.pgm", img);
+
+        for (int r = 0; r < n; ++r) {
+            for (int c = 0; c < n; ++c) {
+                const float v = vel[size_t(n - 1 - r) * n + c];
+                const double l = vMax > 0 ? 0.5 + 0.5 * double(v) / double(vMax) : 0.5;
+                img[size_t(r) * n + c] = static_cast<unsigned char>(255.0 * std::clamp(l, 0.0, 1.0) + 0.5);
+            }
+        }
+        bytes += savePGM(name + "_velocity.pgm", img);
+        return bytes;
+    }
+
+    long long savePGM(const std::string& path, const std::vector<unsigned char>& img) const {
+        std::ofstream out(path, std::ios::binary);
+        if (!out) throw std::runtime_error("Cannot create " + path);
+        const std::string header = "P5\n" + std::to_string(n) + " " + std::to_string(n) + "\n255\n";
+        out << header;
+        out.write(reinterpret_cast<const char*>(img.data()), img.size());
+        return static_cast<long long>(header.size() + img.size());
+    }
+};
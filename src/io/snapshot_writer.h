@@ -0,0 +1,186 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "struct/particle.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+/**
+ * @brief Writes snapshots on a background thread while the simulation goes on.
+ * submit() copies the lanes a snapshot needs into one of a fixed set of staging buffers and
+ * returns; the writer thread formats and writes the staged copy and then hands the buffer back.
+ * With two buffers one snapshot can be written while the next is staged. When every buffer is
+ * still queued, submit() waits for the oldest write to finish, so a slow disk slows the
+ * simulation down instead of piling up copies in memory. With zero buffers every snapshot is
+ * written synchronously inside submit().
+ */
+class SnapshotWriter {
+public:
+    using WriteFn = void (*)(const Particle&, const std::string&);
+
+    /** @brief Totals of the finished writes. */
+    struct Stats {
+        long long files = 0;
+        long long bytes = 0;        // Size of the written files; only measured in NEXT_PROFILE builds
+        double writeSeconds = 0;    // Time the writer spent writing
+        double waitSeconds = 0;     // Time submit() blocked because every buffer was queued
+    };
+
+    explicit SnapshotWriter(int buffers = 2) {
+        for (int b = 0; b < buffers; ++b) free.push_back(std::make_unique<Particle>());
+        async = buffers > 0;
+    }
+
+    ~SnapshotWriter() { close(); }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    /**
+     * @brief Queues 'p' to be written to 'path' by 'write'. p may change as soon as this returns.
+     */
+    void submit(const Particle& p, const std::string& path, WriteFn write) {
+        if (!async) {
+            run(Job{ nullptr, path, write }, p);
+            return;
+        }
+        if (!worker.joinable()) worker = std::thread([this] { loop(); });
+
+        std::unique_ptr<Particle> buf;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            const auto t0 = std::chrono::steady_clock::now();
+            bufferFreed.wait(lock, [this] { return !free.empty(); });
+            totals.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            buf = std::move(free.back());
+            free.pop_back();
+        }
+
+        stage(p, *buf);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(Job{ std::move(buf), path, write });
+        }
+        jobQueued.notify_one();
+    }
+
+    /** @brief Waits until every queued snapshot is on disk. */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return queue.empty() && !busy; });
+    }
+
+    /** @brief Writes out what is still queued and stops the writer thread. */
+    void close() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        jobQueued.notify_one();
+        worker.join();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return totals;
+    }
+
+private:
+    struct Job {
+        std::unique_ptr<Particle> data;
+        std::string path;
+        WriteFn write;
+    };
+
+    /**
+     * @brief Copies the lanes the writers read. Assigning into the staging lanes reuses their
+     * storage, so only the first snapshot (or a grown particle count) allocates.
+     */
+    static void stage(const Particle& p, Particle& out) {
+        out.x = p.x; out.y = p.y; out.z = p.z;
+        out.vx = p.vx; out.vy = p.vy; out.vz = p.vz;
+        out.m = p.m; out.type = p.type; out.id = p.id;
+    }
+
+    /** @brief Writes one snapshot and adds it to the totals. */
+    void run(const Job& job, const Particle& p) {
+        const auto t0 = std::chrono::steady_clock::now();
+        try {
+            job.write(p, job.path);
+        } catch (const std::exception& e) {
+            std::cerr << "Writing " << job.path << " failed: " << e.what() << std::endl;
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+#ifdef NEXT_PROFILE
+        // The writers do not report their size, so it costs a reopen; only the profile uses it
+        std::ifstream f(job.path, std::ios::binary | std::ios::ate);
+        const long long bytes = f ? static_cast<long long>(f.tellg()) : 0;
+#endif
+
+        std::lock_guard<std::mutex> lock(mutex);
+        totals.files++;
+#ifdef NEXT_PROFILE
+        totals.bytes += bytes;
+#endif
+        totals.writeSeconds += seconds;
+    }
+
+    void loop() {
+        // The writers' own OpenMP loops run on this thread only, next to the force threads
+        omp_set_num_threads(1);
+
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                jobQueued.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                job = std::move(queue.front());
+                queue.pop_front();
+                busy = true;
+            }
+
+            run(job, *job.data);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                free.push_back(std::move(job.data));
+                busy = false;
+            }
+            bufferFreed.notify_one();
+            idle.notify_all();
+        }
+    }
+
+    bool async = true;
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::condition_variable jobQueued, bufferFreed, idle;
+    std::deque<Job> queue;
+    std::vector<std::unique_ptr<Particle>> free;
+    bool busy = false;
+    bool stopping = false;
+    Stats totals;
+};
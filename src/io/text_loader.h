@@ -0,0 +1,156 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "mapped_file.h"
+#include "struct/particle.h"
+#include "floatdef.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <omp.h>
+
+/**
+ * @brief Parses one whitespace-separated number starting at p (leading blanks are skipped)
+ * and advances p past it. Returns false if there is no number or it is followed by garbage.
+ */
+template <typename T>
+inline bool ParseTextField(const char*& p, const char* end, T& value) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+    if (p < end && *p == '+') ++p;    // from_chars does not take an explicit plus sign
+    const char* first = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+    if (first == p) return false;
+
+#if defined(__cpp_lib_to_chars) || !defined(_LIBCPP_VERSION)
+    const std::from_chars_result r = std::from_chars(first, p, value);
+    return r.ec == std::errc() && r.ptr == p;
+#else
+    // libc++ without floating-point from_chars: the token is copied so strto* stops at its end
+    char token[64];
+    const size_t n = static_cast<size_t>(p - first);
+    if (n >= sizeof(token)) return false;
+    std::memcpy(token, first, n);
+    token[n] = '\0';
+    char* stop = nullptr;
+    if constexpr (std::is_integral_v<T>) value = static_cast<T>(std::strtol(token, &stop, 10));
+    else value = static_cast<T>(std::strtod(token, &stop));
+    return stop == token + n;
+#endif
+}
+
+/**
+ * @brief Loads a plain-text particle file: one particle per line,
+ * "x y z vx vy vz m type", blank lines ignored.
+ * The file is memory-mapped and cut at line boundaries into one chunk per thread. A first
+ * pass counts the particles of every chunk, the lanes are sized once, and a second pass parses
+ * every chunk straight into its part of the lanes. With parts > 1 only share 'part' of the
+ * particles is parsed (the same split as the MPI ranks use); IDs are left 0.
+ * Malformed lines throw std::runtime_error with the file name and line number.
+ */
+inline Particle LoadTextParticles(const std::string& filename, int part = 0, int parts = 1) {
+    MappedFile file(filename);
+    const char* text = file.data();
+    const size_t bytes = file.size();
+
+    // Chunks of at least 1 MiB, starting right after a newline
+    constexpr size_t kMinChunk = size_t(1) << 20;
+    const int chunks = static_cast<int>(std::max<size_t>(1, std::min<size_t>(omp_get_max_threads(), bytes / kMinChunk)));
+    std::vector<size_t> bounds(chunks + 1, bytes);
+    bounds[0] = 0;
+    for (int c = 1; c < chunks; ++c) {
+        size_t b = std::max(bytes * c / chunks, bounds[c - 1]);
+        const void* nl = b < bytes ? std::memchr(text + b, '\n', bytes - b) : nullptr;
+        bounds[c] = nl ? static_cast<size_t>(static_cast<const char*>(nl) - text) + 1 : bytes;
+    }
+
+    auto blank = [](const char* p, const char* e) {
+        for (; p < e; ++p)
+            if (*p != ' ' && *p != '\t' && *p != '\r') return false;
+        return true;
+    };
+
+    // Pass 1: lines and particles per chunk
+    std::vector<size_t> lines(chunks + 1, 0), records(chunks + 1, 0);
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < chunks; ++c) {
+        const char* p = text + bounds[c];
+        const char* end = text + bounds[c + 1];
+        size_t nl = 0, nr = 0;
+        while (p < end) {
+            const char* e = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!e) e = end;
+            ++nl;
+            if (!blank(p, e)) ++nr;
+            p = e + 1;
+        }
+        lines[c + 1] = nl;
+        records[c + 1] = nr;
+    }
+    for (int c = 0; c < chunks; ++c) {
+        lines[c + 1] += lines[c];
+        records[c + 1] += records[c];
+    }
+
+    const size_t N = records[chunks];
+    const size_t first = (N * part) / parts;
+    const size_t last = (N * (part + 1)) / parts;
+    const size_t n = last - first;
+
+    Particle p;
+    p.x.resize(n); p.y.resize(n); p.z.resize(n);
+    p.vx.resize(n); p.vy.resize(n); p.vz.resize(n);
+    p.ax.assign(n, 0); p.ay.assign(n, 0); p.az.assign(n, 0);
+    p.m.resize(n); p.type.resize(n); p.id.assign(n, 0);
+
+    // Pass 2: parse the lines of this part; every chunk reports its first bad line
+    std::vector<size_t> badLine(chunks, 0);
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < chunks; ++c) {
+        if (records[c + 1] <= first || records[c] >= last) continue;
+        const char* s = text + bounds[c];
+        const char* end = text + bounds[c + 1];
+        size_t line = lines[c], k = records[c];
+        while (s < end && k < last) {
+            const char* e = static_cast<const char*>(std::memchr(s, '\n', end - s));
+            if (!e) e = end;
+            ++line;
+            if (!blank(s, e)) {
+                if (k >= first) {
+                    const size_t i = k - first;
+                    const char* q = s;
+                    bool ok = ParseTextField(q, e, p.x[i]) && ParseTextField(q, e, p.y[i]) &&
+                              ParseTextField(q, e, p.z[i]) && ParseTextField(q, e, p.vx[i]) &&
+                              ParseTextField(q, e, p.vy[i]) && ParseTextField(q, e, p.vz[i]) &&
+                              ParseTextField(q, e, p.m[i]) && ParseTextField(q, e, p.type[i]);
+                    if (!ok || !blank(q, e)) {
+                        badLine[c] = line;
+                        break;
+                    }
+                }
+                ++k;
+            }
+            s = e + 1;
+        }
+    }
+
+    for (size_t line : badLine) {
+        if (line > 0)
+            throw std::runtime_error(filename + ":" + std::to_string(line) +
+                                     ": expected \"x y z vx vy vz m type\"");
+    }
+    return p;
+}
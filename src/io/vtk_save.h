@@ -13,6 +13,9 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include "struct/particle.h"
 
 /**
@@ -58,6 +61,13 @@ inline void SaveVTK(const Particle& p, const std::string& filename)
         out << p.type[i] << "\n";
     }
 
+    // --- Persistent particle ID ---
+    out << "SCALARS id unsigned_long 1\n";
+    out << "LOOKUP_TABLE default\n";
+    for (size_t i = 0; i < N; i++) {
+        out << p.id[i] << "\n";
+    }
+
     // --- Velocity Vectors ---
     out << "VECTORS velocity " << vtkType << "\n";
     for (size_t i = 0; i < N; i++) {
@@ -73,3 +83,90 @@ inline void SaveVTK(const Particle& p, const std::string& filename)
 
     out.close();
 }
+
+/**
+ * @brief Writes count values of type T in big-endian byte order (as legacy VTK BINARY requires).
+ * value(k) gives element k. The values go through a fixed-size buffer that is filled and
+ * byte-swapped in parallel, then written in one call.
+ */
+template <typename T, typename F>
+inline void WriteBigEndian(std::ostream& out, size_t count, F&& value)
+{
+    constexpr size_t kChunk = size_t(1) << 16;
+    const uint16_t probe = 1;
+    const bool swap = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+
+    std::vector<unsigned char> buf(std::min(count, kChunk) * sizeof(T));
+    for (size_t first = 0; first < count; first += kChunk) {
+        const long long n = static_cast<long long>(std::min(kChunk, count - first));
+        #pragma omp parallel for schedule(static)
+        for (long long k = 0; k < n; ++k) {
+            const T v = value(first + size_t(k));
+            unsigned char* dst = &buf[size_t(k) * sizeof(T)];
+            std::memcpy(dst, &v, sizeof(T));
+            if (swap) std::reverse(dst, dst + sizeof(T));
+        }
+        out.write(reinterpret_cast<const char*>(buf.data()), n * sizeof(T));
+    }
+    out << "\n";
+}
+
+/**
+ * @brief Saves the SoA Particle database to a BINARY legacy VTK file (output format vtk-bin).
+ * Same layout as SaveVTK, with every array written as raw big-endian values in the precision
+ * of the build. Legacy cell lists are 32-bit, so this format is limited to 2^31 - 1 particles.
+ */
+inline void SaveVTKBinary(const Particle& p, const std::string& filename)
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) return;
+
+    const size_t N = p.size();
+    out << "# vtk DataFile Version 3.0\n";
+    out << "NEXT snapshot\n";
+    out << "BINARY\n";
+    out << "DATASET POLYDATA\n";
+
+    #ifdef NEXT_FP64
+    constexpr const char* vtkType = "double";
+    #else
+    constexpr const char* vtkType = "float";
+    #endif
+
+    // --- POINTS (Coordinates) ---
+    out << "POINTS " << N << " " << vtkType << "\n";
+    WriteBigEndian<real>(out, 3 * N, [&](size_t k) {
+        const size_t i = k / 3;
+        return (k % 3 == 0) ? p.x[i] : (k % 3 == 1) ? p.y[i] : p.z[i];
+    });
+
+    // --- VERTICES: "1 i" per particle ---
+    out << "VERTICES " << N << " " << N * 2 << "\n";
+    WriteBigEndian<int32_t>(out, 2 * N, [](size_t k) {
+        return (k % 2 == 0) ? int32_t(1) : static_cast<int32_t>(k / 2);
+    });
+
+    out << "POINT_DATA " << N << "\n";
+
+    // --- Type (0 for Star, 1 for DM) ---
+    out << "SCALARS type int 1\n";
+    out << "LOOKUP_TABLE default\n";
+    WriteBigEndian<int32_t>(out, N, [&](size_t i) { return static_cast<int32_t>(p.type[i]); });
+
+    // --- Persistent particle ID ---
+    out << "SCALARS id vtktypeuint64 1\n";
+    out << "LOOKUP_TABLE default\n";
+    WriteBigEndian<uint64_t>(out, N, [&](size_t i) { return p.id[i]; });
+
+    // --- Velocity Vectors ---
+    out << "VECTORS velocity " << vtkType << "\n";
+    WriteBigEndian<real>(out, 3 * N, [&](size_t k) {
+        const size_t i = k / 3;
+        return (k % 3 == 0) ? p.vx[i] : (k % 3 == 1) ? p.vy[i] : p.vz[i];
+    });
+
+    // --- Mass ---
+    out << "SCALARS mass " << vtkType << " 1\n";
+    out << "LOOKUP_TABLE default\n";
+    WriteBigEndian<real>(out, N, [&](size_t i) { return p.m[i]; });
+}
@@ -13,7 +13,21 @@
 #include <vector>
 #include <string>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <algorithm>
 #include "struct/particle.h"
+#ifdef NEXT_HAVE_ZLIB
+    #include <zlib.h>
+#endif
+
+// VTK name of 'real', so the files say what they hold
+#ifdef NEXT_FP64
+constexpr const char* kVtuReal = "Float64";
+#else
+constexpr const char* kVtuReal = "Float32";
+#endif
 
 /**
  * @brief Saves the SoA Particle database to a VTU (XML) file.
@@ -34,7 +48,7 @@ inline void SaveVTU(const Particle& p, const std::string& filename)
 
     // --- POINTS (Coordinates) ---
     out << "      <Points>\n";
-    out << "        <DataArray type=\"Float32\" NumberOfComponents=\"3\" format=\"ascii\">\n          ";
+    out << "        <DataArray type=\"" << kVtuReal << "\" NumberOfComponents=\"3\" format=\"ascii\">\n          ";
     for (size_t i = 0; i < N; i++)
         out << p.x[i] << " " << p.y[i] << " " << p.z[i] << " ";
     out << "\n        </DataArray>\n      </Points>\n";
@@ -62,17 +76,182 @@ inline void SaveVTU(const Particle& p, const std::string& filename)
         out << p.type[i] << " ";
     out << "\n        </DataArray>\n";
 
+    // Persistent particle ID
+    out << "        <DataArray type=\"UInt64\" Name=\"id\" format=\"ascii\">\n          ";
+    for (size_t i = 0; i < N; i++)
+        out << p.id[i] << " ";
+    out << "\n        </DataArray>\n";
+
     // Velocity
-    out << "        <DataArray type=\"Float32\" Name=\"velocity\" NumberOfComponents=\"3\" format=\"ascii\">\n          ";
+    out << "        <DataArray type=\"" << kVtuReal << "\" Name=\"velocity\" NumberOfComponents=\"3\" format=\"ascii\">\n          ";
     for (size_t i = 0; i < N; i++)
         out << p.vx[i] << " " << p.vy[i] << " " << p.vz[i] << " ";
     out << "\n        </DataArray>\n";
 
     // Mass
-    out << "        <DataArray type=\"Float32\" Name=\"mass\" format=\"ascii\">\n          ";
+    out << "        <DataArray type=\"" << kVtuReal << "\" Name=\"mass\" format=\"ascii\">\n          ";
     for (size_t i = 0; i < N; i++)
         out << p.m[i] << " ";
     out << "\n        </DataArray>\n";
 
     out << "      </PointData>\n    </Piece>\n  </UnstructuredGrid>\n</VTKFile>\n";
 }
+
+/**
+ * @brief One array of a binary VTU file: its XML attributes, the size of one tuple in bytes,
+ * and a function that writes tuples [first, first + count) in native byte order to 'out'.
+ */
+struct VtuArray {
+    std::string attributes;
+    size_t tupleBytes;
+    std::function<void(size_t first, size_t count, unsigned char* out)> fill;
+};
+
+/**
+ * @brief Saves the SoA Particle database to a VTU file with all arrays in one raw binary
+ * <AppendedData> block (format="appended"), in the precision of the build.
+ * With 'compress' every array is cut into blocks of about 1 MiB that are zlib-compressed in
+ * parallel (vtkZLibDataCompressor); builds without zlib write the data uncompressed.
+ * Connectivity, offsets and cell types are generated block by block and never formatted as text.
+ */
+inline void SaveVTUBinary(const Particle& p, const std::string& filename, bool compress)
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) return;
+
+    const size_t N = p.size();
+    const char* realType = kVtuReal;
+
+    auto copyXYZ = [](const std::vector<real>& a, const std::vector<real>& b, const std::vector<real>& c) {
+        return [&a, &b, &c](size_t first, size_t count, unsigned char* dst) {
+            real* o = reinterpret_cast<real*>(dst);
+            for (size_t k = 0; k < count; ++k) {
+                o[3 * k] = a[first + k]; o[3 * k + 1] = b[first + k]; o[3 * k + 2] = c[first + k];
+            }
+        };
+    };
+    auto copyLane = [](const auto& lane) {
+        return [&lane](size_t first, size_t count, unsigned char* dst) {
+            std::memcpy(dst, lane.data() + first, count * sizeof(lane[0]));
+        };
+    };
+
+    const std::string points = std::string("type=\"") + realType + "\" NumberOfComponents=\"3\"";
+    std::vector<VtuArray> arrays = {
+        { points, 3 * sizeof(real), copyXYZ(p.x, p.y, p.z) },
+        { "type=\"Int64\" Name=\"connectivity\"", sizeof(int64_t), [](size_t first, size_t count, unsigned char* dst) {
+            int64_t* o = reinterpret_cast<int64_t*>(dst);
+            for (size_t k = 0; k < count; ++k) o[k] = static_cast<int64_t>(first + k);
+        } },
+        { "type=\"Int64\" Name=\"offsets\"", sizeof(int64_t), [](size_t first, size_t count, unsigned char* dst) {
+            int64_t* o = reinterpret_cast<int64_t*>(dst);
+            for (size_t k = 0; k < count; ++k) o[k] = static_cast<int64_t>(first + k + 1);
+        } },
+        { "type=\"UInt8\" Name=\"types\"", 1, [](size_t, size_t count, unsigned char* dst) {
+            std::memset(dst, 1, count);   // 1 = VTK_VERTEX
+        } },
+        { "type=\"Int32\" Name=\"type\"", sizeof(int), copyLane(p.type) },
+        { "type=\"UInt64\" Name=\"id\"", sizeof(uint64_t), copyLane(p.id) },
+        { std::string("type=\"") + realType + "\" Name=\"velocity\" NumberOfComponents=\"3\"", 3 * sizeof(real), copyXYZ(p.vx, p.vy, p.vz) },
+        { std::string("type=\"") + realType + "\" Name=\"mass\"", sizeof(real), copyLane(p.m) },
+    };
+    const size_t A = arrays.size();
+
+#ifndef NEXT_HAVE_ZLIB
+    compress = false;
+#endif
+
+    // Encoded size of every array: header (UInt64 words) plus data
+    constexpr size_t kBlockTarget = size_t(1) << 20;
+    std::vector<uint64_t> encoded(A);
+    std::vector<std::vector<std::vector<unsigned char>>> blocks(A);   // Compressed blocks
+    std::vector<std::vector<uint64_t>> headers(A);
+
+    for (size_t a = 0; a < A; ++a) {
+        const VtuArray& arr = arrays[a];
+        const uint64_t rawBytes = uint64_t(N) * arr.tupleBytes;
+        if (!compress) {
+            headers[a] = { rawBytes };
+            encoded[a] = sizeof(uint64_t) + rawBytes;
+            continue;
+        }
+#ifdef NEXT_HAVE_ZLIB
+        // VTK block header: count, uncompressed block size, size of the last block, compressed sizes
+        const size_t perBlock = std::max<size_t>(1, kBlockTarget / arr.tupleBytes);
+        const size_t nBlocks = (N + perBlock - 1) / perBlock;
+        blocks[a].resize(nBlocks);
+        #pragma omp parallel
+        {
+            std::vector<unsigned char> raw(perBlock * arr.tupleBytes);
+            #pragma omp for schedule(dynamic, 1)
+            for (long long b = 0; b < static_cast<long long>(nBlocks); ++b) {
+                const size_t first = size_t(b) * perBlock;
+                const size_t count = std::min(perBlock, N - first);
+                const uLong len = static_cast<uLong>(count * arr.tupleBytes);
+                arr.fill(first, count, raw.data());
+                uLongf packed = compressBound(len);
+                blocks[a][b].resize(packed);
+                compress2(blocks[a][b].data(), &packed, raw.data(), len, Z_BEST_SPEED);
+                blocks[a][b].resize(packed);
+            }
+        }
+        const uint64_t last = nBlocks ? (N - (nBlocks - 1) * perBlock) * arr.tupleBytes : 0;
+        headers[a] = { uint64_t(nBlocks), uint64_t(perBlock * arr.tupleBytes), last };
+        encoded[a] = 0;
+        for (const auto& blk : blocks[a]) {
+            headers[a].push_back(blk.size());
+            encoded[a] += blk.size();
+        }
+        encoded[a] += headers[a].size() * sizeof(uint64_t);
+#endif
+    }
+
+    // XML header with the offset of every array in the appended block
+    const uint16_t probe = 1;
+    const bool little = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    out << "<?xml version=\"1.0\"?>\n";
+    out << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\""
+        << (little ? "LittleEndian" : "BigEndian") << "\" header_type=\"UInt64\""
+        << (compress ? " compressor=\"vtkZLibDataCompressor\"" : "") << ">\n";
+    out << "  <UnstructuredGrid>\n";
+    out << "    <Piece NumberOfPoints=\"" << N << "\" NumberOfCells=\"" << N << "\">\n";
+
+    uint64_t offset = 0;
+    auto dataArray = [&](size_t a) {
+        out << "        <DataArray " << arrays[a].attributes << " format=\"appended\" offset=\"" << offset << "\"/>\n";
+        offset += encoded[a];
+    };
+    out << "      <Points>\n";
+    dataArray(0);
+    out << "      </Points>\n      <Cells>\n";
+    dataArray(1); dataArray(2); dataArray(3);
+    out << "      </Cells>\n      <PointData>\n";
+    for (size_t a = 4; a < A; ++a) dataArray(a);
+    out << "      </PointData>\n    </Piece>\n  </UnstructuredGrid>\n";
+    out << "  <AppendedData encoding=\"raw\">\n   _";
+
+    // Appended data, in the order of the offsets
+    std::vector<unsigned char> chunk;
+    for (size_t a = 0; a < A; ++a) {
+        out.write(reinterpret_cast<const char*>(headers[a].data()), headers[a].size() * sizeof(uint64_t));
+        if (compress) {
+            for (const auto& blk : blocks[a]) out.write(reinterpret_cast<const char*>(blk.data()), blk.size());
+            continue;
+        }
+        const size_t perChunk = std::max<size_t>(1, kBlockTarget / arrays[a].tupleBytes);
+        chunk.resize(perChunk * arrays[a].tupleBytes);
+        for (size_t first = 0; first < N; first += perChunk) {
+            const size_t count = std::min(perChunk, N - first);
+            arrays[a].fill(first, count, chunk.data());
+            out.write(reinterpret_cast<const char*>(chunk.data()), count * arrays[a].tupleBytes);
+        }
+    }
+
+    out << "\n  </AppendedData>\n</VTKFile>\n";
+}
+
+/** @brief Binary appended VTU, uncompressed (output format vtu-bin). */
+inline void SaveVTUAppended(const Particle& p, const std::string& filename) { SaveVTUBinary(p, filename, false); }
+
+/** @brief Binary appended VTU with zlib-compressed blocks (output format vtu-zlib). */
+inline void SaveVTUCompressed(const Particle& p, const std::string& filename) { SaveVTUBinary(p, filename, true); }
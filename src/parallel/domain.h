@@ -0,0 +1,315 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include "mpi_types.h"
+#include "gravity/morton.h"
+#include "gravity/octree.h"
+#include "struct/particle.h"
+#include "util/profile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include <mpi.h>
+
+/**
+ * @brief Bounding box of the particles of all ranks.
+ */
+inline BBox globalBounds(const ParticleSystem& ps) {
+    BBox local = computeBounds(ps);
+    real mins[3] = {local.minx, local.miny, local.minz};
+    real maxs[3] = {local.maxx, local.maxy, local.maxz};
+
+    MPI_Allreduce(MPI_IN_PLACE, mins, 3, mpiRealType(), MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, maxs, 3, mpiRealType(), MPI_MAX, MPI_COMM_WORLD);
+
+    return BBox{mins[0], mins[1], mins[2], maxs[0], maxs[1], maxs[2]};
+}
+
+/**
+ * @brief Collective Particle::assignIds() for particle sets loaded in per-rank slices:
+ * new IDs continue after the largest ID on any rank and follow the rank order, so a run
+ * gets the same IDs whatever the number of ranks.
+ */
+inline void assignGlobalIds(ParticleSystem& ps) {
+    ps.id.resize(ps.size(), 0);
+    unsigned long long maxId = 0, missing = 0;
+    for (uint64_t v : ps.id) {
+        maxId = std::max<unsigned long long>(maxId, v);
+        missing += (v == 0);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &maxId, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    unsigned long long before = 0;
+    MPI_Exscan(&missing, &before, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank == 0) before = 0;    // MPI_Exscan leaves rank 0's result undefined
+
+    uint64_t next = maxId + 1 + before;
+    for (uint64_t& v : ps.id) {
+        if (v == 0) v = next++;
+    }
+}
+
+/**
+ * @brief Space-filling-curve domain decomposition with locally essential trees.
+ * Every rank owns one contiguous stretch of the global Morton curve and only stores the
+ * particles in it. For the forces, each rank walks its local tree against the bounding box of
+ * every other rank and sends the nodes that rank's targets would accept as they are (multipole
+ * and size) and the leaves they would reach as single particles. The receiver appends these
+ * ghosts to its own particles and builds one tree over both, so the Barnes-Hut walks and the
+ * FMM run unchanged; ghost leaves carry the quadrupole and size of the node they stand for.
+ */
+struct Domain {
+    std::vector<uint64_t> splitters;    // Rank r owns the keys in [splitters[r-1], splitters[r])
+
+    /**
+     * @brief Moves every particle to the rank owning its Morton key and sorts each rank's
+     * particles along the curve. Splitters are chosen so every rank gets the same predicted
+     * force work: the interaction count of each particle's last evaluation (ps.cost) times the
+     * number of evaluations per step on its block-timestep rung. Particles without a recorded
+     * cost count as the mean of those with one.
+     */
+    void decompose(ParticleSystem& ps) {
+        int size = 1;
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+        std::vector<uint64_t> keys;
+        std::vector<int> order;
+        {
+            NEXT_PROFILE_SCOPE("domain.sort");
+            computeMortonKeys(ps, globalBounds(ps), keys);
+            radixSortKeys(keys, order);
+            ps.permute(order);
+        }
+
+        // Lanes that are not in use yet still have to travel, so every rank sends the same set
+        const size_t N = ps.size();
+        ps.forEachLane([&](auto& lane) {
+            if (lane.size() != N) lane.assign(N, {});
+        });
+
+        {
+            NEXT_PROFILE_SCOPE("domain.splitters");
+            chooseSplitters(keys, workWeights(ps), size);
+        }
+
+        NEXT_PROFILE_SCOPE("domain.exchange");
+        std::vector<int> sendCounts(size), sendDispls(size), recvCounts(size), recvDispls(size);
+        for (int r = 0; r < size; ++r) {
+            auto begin = (r == 0) ? keys.begin() : std::lower_bound(keys.begin(), keys.end(), splitters[r - 1]);
+            auto end   = (r == size - 1) ? keys.end() : std::lower_bound(keys.begin(), keys.end(), splitters[r]);
+            sendDispls[r] = static_cast<int>(begin - keys.begin());
+            sendCounts[r] = static_cast<int>(end - begin);
+        }
+        MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        std::exclusive_scan(recvCounts.begin(), recvCounts.end(), recvDispls.begin(), 0);
+        const int received = recvDispls[size - 1] + recvCounts[size - 1];
+
+        ps.forEachLane([&](auto& lane) {
+            using T = typename std::decay_t<decltype(lane)>::value_type;
+            std::vector<T> in(received);
+            MPI_Alltoallv(lane.data(), sendCounts.data(), sendDispls.data(), mpiType<T>(),
+                          in.data(), recvCounts.data(), recvDispls.data(), mpiType<T>(), MPI_COMM_WORLD);
+            lane.swap(in);
+        });
+
+        // Particles arrive in one sorted run per sender; restore a single curve order
+        reorderParticles(ps);
+    }
+
+    /**
+     * @brief Exchanges the locally essential tree and appends the received ghosts to ps.x/y/z/m/type.
+     * 'local' must be built over the particles of this rank only. Returns the number of ghosts.
+     */
+    int importGhosts(const Octree& local, ParticleSystem& ps, real theta) {
+        int rank = 0, size = 1;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+        BBox mine = computeBounds(ps);
+        std::vector<BBox> boxes(size);
+        {
+            NEXT_PROFILE_SCOPE("ghosts.bounds");
+            MPI_Allgather(&mine, 6, mpiRealType(), boxes.data(), 6, mpiRealType(), MPI_COMM_WORLD);
+        }
+
+        std::vector<std::vector<real>> out(size);
+        {
+            NEXT_PROFILE_SCOPE("ghosts.export");
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int r = 0; r < size; ++r) {
+                const BBox& b = boxes[r];
+                if (r == rank || local.empty() || b.minx > b.maxx) continue;
+                exportTo(local, b, theta, out[r]);
+            }
+        }
+
+        NEXT_PROFILE_SCOPE("ghosts.exchange");
+        std::vector<int> sendCounts(size), sendDispls(size), recvCounts(size), recvDispls(size);
+        for (int r = 0; r < size; ++r) sendCounts[r] = static_cast<int>(out[r].size());
+        std::exclusive_scan(sendCounts.begin(), sendCounts.end(), sendDispls.begin(), 0);
+        MPI_Alltoall(sendCounts.data(), 1, MPI_INT, recvCounts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        std::exclusive_scan(recvCounts.begin(), recvCounts.end(), recvDispls.begin(), 0);
+
+        std::vector<real> send(sendDispls[size - 1] + sendCounts[size - 1]);
+        for (int r = 0; r < size; ++r) std::copy(out[r].begin(), out[r].end(), send.begin() + sendDispls[r]);
+        std::vector<real> in(recvDispls[size - 1] + recvCounts[size - 1]);
+        MPI_Alltoallv(send.data(), sendCounts.data(), sendDispls.data(), mpiRealType(),
+                      in.data(), recvCounts.data(), recvDispls.data(), mpiRealType(), MPI_COMM_WORLD);
+
+        const int nLocal = static_cast<int>(ps.size());
+        const int nGhost = static_cast<int>(in.size() / kItem);
+        ps.x.resize(nLocal + nGhost); ps.y.resize(nLocal + nGhost); ps.z.resize(nLocal + nGhost);
+        ps.m.resize(nLocal + nGhost); ps.type.resize(nLocal + nGhost, 0);
+        ghostSize.resize(nGhost);
+        ghostQ.resize(6 * static_cast<size_t>(nGhost));
+
+        #pragma omp parallel for schedule(static)
+        for (int g = 0; g < nGhost; ++g) {
+            const real* item = &in[static_cast<size_t>(g) * kItem];
+            ps.x[nLocal + g] = item[0]; ps.y[nLocal + g] = item[1]; ps.z[nLocal + g] = item[2];
+            ps.m[nLocal + g] = item[3];
+            ghostSize[g] = item[4];
+            std::copy(item + 5, item + kItem, &ghostQ[6 * static_cast<size_t>(g)]);
+        }
+        return nGhost;
+    }
+
+    /**
+     * @brief Gives the leaves of ghosts (index >= nLocal) the size and quadrupole of their source node.
+     * Call after building the tree over local particles plus ghosts.
+     */
+    void patchGhostLeaves(Octree& tree, int nLocal) const {
+        const int count = static_cast<int>(tree.nodes.size());
+        #pragma omp parallel for schedule(static)
+        for (int n = 0; n < count; ++n) {
+            OctreeNode& node = tree.nodes[n];
+            if (!node.leaf || node.bodyIdx < nLocal) continue;
+            const size_t g = static_cast<size_t>(node.bodyIdx - nLocal);
+            const real* Q = &ghostQ[6 * g];
+            node.size = ghostSize[g];
+            node.Qxx = Q[0]; node.Qyy = Q[1]; node.Qzz = Q[2];
+            node.Qxy = Q[3]; node.Qxz = Q[4]; node.Qyz = Q[5];
+        }
+    }
+
+    /**
+     * @brief Removes the ghosts appended by importGhosts().
+     */
+    static void dropGhosts(ParticleSystem& ps, int nLocal) {
+        ps.x.resize(nLocal); ps.y.resize(nLocal); ps.z.resize(nLocal);
+        ps.m.resize(nLocal); ps.type.resize(nLocal);
+    }
+
+private:
+    static constexpr int kSamplesPerRank = 256;
+    static constexpr size_t kItem = 11;           // x, y, z, m, size, Qxx, Qyy, Qzz, Qxy, Qxz, Qyz
+
+    std::vector<real> ghostSize, ghostQ;
+
+    /**
+     * @brief Predicted force work of every particle for the next step (see decompose()).
+     */
+    static std::vector<double> workWeights(const ParticleSystem& ps) {
+        const size_t N = ps.size();
+        double known = 0;
+        size_t nKnown = 0;
+        for (size_t i = 0; i < N; ++i) {
+            if (ps.cost[i] > 0) { known += ps.cost[i]; ++nKnown; }
+        }
+        const double fallback = nKnown ? known / nKnown : 1.0;
+
+        std::vector<double> w(N);
+        #pragma omp parallel for schedule(static)
+        for (long long i = 0; i < static_cast<long long>(N); ++i) {
+            const double c = ps.cost[i] > 0 ? double(ps.cost[i]) : fallback;
+            w[i] = std::ldexp(c, ps.rung[i]);
+        }
+        return w;
+    }
+
+    /**
+     * @brief Picks size - 1 splitters from samples of every rank's sorted keys.
+     * Sample k of a rank stands for the k-th of kSamplesPerRank equal runs of its particles and
+     * carries their total weight, so the cuts fall at equal fractions of the global weight.
+     */
+    void chooseSplitters(const std::vector<uint64_t>& keys, const std::vector<double>& weights, int size) {
+        const int N = static_cast<int>(keys.size());
+        const int S = std::min(kSamplesPerRank, N);
+
+        std::vector<uint64_t> sampleKeys(S);
+        std::vector<double> sampleWeights(S, 0.0);
+        for (int k = 0; k < S; ++k) {
+            const size_t begin = (static_cast<size_t>(k) * N) / S;
+            const size_t end   = (static_cast<size_t>(k + 1) * N) / S;
+            sampleKeys[k] = keys[(begin + end) / 2];
+            for (size_t i = begin; i < end; ++i) sampleWeights[k] += weights[i];
+        }
+
+        std::vector<int> counts(size), displs(size);
+        MPI_Allgather(&S, 1, MPI_INT, counts.data(), 1, MPI_INT, MPI_COMM_WORLD);
+        std::exclusive_scan(counts.begin(), counts.end(), displs.begin(), 0);
+        const int total = displs[size - 1] + counts[size - 1];
+
+        std::vector<uint64_t> allKeys(total);
+        std::vector<double> allWeights(total);
+        MPI_Allgatherv(sampleKeys.data(), S, MPI_UINT64_T, allKeys.data(), counts.data(), displs.data(),
+                       MPI_UINT64_T, MPI_COMM_WORLD);
+        MPI_Allgatherv(sampleWeights.data(), S, MPI_DOUBLE, allWeights.data(), counts.data(), displs.data(),
+                       MPI_DOUBLE, MPI_COMM_WORLD);
+
+        std::vector<int> idx(total);
+        std::iota(idx.begin(), idx.end(), 0);
+        std::sort(idx.begin(), idx.end(), [&](int a, int b) { return allKeys[a] < allKeys[b]; });
+
+        const double W = std::accumulate(allWeights.begin(), allWeights.end(), 0.0);
+        splitters.assign(size - 1, ~uint64_t(0));
+        double cum = 0;
+        int next = 1;
+        for (int k = 0; k < total && next < size; ++k) {
+            cum += allWeights[idx[k]];
+            while (next < size && cum >= W * next / size) splitters[(next++) - 1] = allKeys[idx[k]];
+        }
+    }
+
+    /**
+     * @brief Appends to 'out' what a rank whose particles lie in box 'b' needs from 'tree':
+     * nodes that every target in the box accepts (size < theta * distance to the box), and
+     * the leaves below the nodes some target would open.
+     */
+    static void exportTo(const Octree& tree, const BBox& b, real theta, std::vector<real>& out) {
+        std::vector<int> stack{0};
+        while (!stack.empty()) {
+            const OctreeNode& n = tree.nodes[stack.back()];
+            stack.pop_back();
+            if (n.m == 0) continue;
+
+            if (!n.leaf) {
+                real dx = std::max({b.minx - n.cx, real(0), n.cx - b.maxx});
+                real dy = std::max({b.miny - n.cy, real(0), n.cy - b.maxy});
+                real dz = std::max({b.minz - n.cz, real(0), n.cz - b.maxz});
+                real d2 = dx*dx + dy*dy + dz*dz;
+                if (!(n.size * n.size < theta * theta * d2)) {
+                    for (int c : n.child) {
+                        if (c >= 0) stack.push_back(c);
+                    }
+                    continue;
+                }
+            }
+            out.insert(out.end(), { n.cx, n.cy, n.cz, n.m, n.size, n.Qxx, n.Qyy, n.Qzz, n.Qxy, n.Qxz, n.Qyz });
+        }
+    }
+};
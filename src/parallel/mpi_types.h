@@ -0,0 +1,36 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+#include "floatdef.h"
+#include <cstdint>
+#include <mpi.h>
+
+/**
+ * @brief MPI datatype matching 'real'.
+ */
+inline MPI_Datatype mpiRealType() {
+#ifdef NEXT_FP64
+    return MPI_DOUBLE;
+#elif defined(NEXT_FP32)
+    return MPI_FLOAT;
+#else
+#   error "Define NEXT_FP32 or NEXT_FP64 for 'real' type."
+#endif
+}
+
+/**
+ * @brief MPI datatype of the element type of a particle lane.
+ */
+template <typename T> MPI_Datatype mpiType();
+template <> inline MPI_Datatype mpiType<real>()     { return mpiRealType(); }
+template <> inline MPI_Datatype mpiType<int>()      { return MPI_INT; }
+template <> inline MPI_Datatype mpiType<uint64_t>() { return MPI_UINT64_T; }
@@ -14,6 +14,7 @@
 #include "dt/softening.h"
 #include <vector>
 #include <cmath>
+#include <cstdint>
 #include <algorithm>
 
 /**
@@ -22,15 +23,21 @@
 struct Particle {
     std::vector<real> x, y, z;
     std::vector<real> vx, vy, vz;
-    std::vector<real> ax, ay, az; // Storing for potential tree-build recycling
+    std::vector<real> ax, ay, az; // Accelerations at the current positions, reused by the next first kick
     std::vector<real> m;
     std::vector<int> type;
+    std::vector<uint64_t> id;     // Persistent particle ID, follows the particle when lanes are reordered
+    std::vector<int> rung;        // Block-timestep rung (step = dtMax / 2^rung), sized by StepBlock
+    std::vector<real> cost;       // Force work of the last evaluation (interactions), used for load balancing
+    bool accValid = false;        // ax/ay/az match the current positions; cleared when the particle set changes
 
     void resize(size_t n) {
         x.resize(n, 0); y.resize(n, 0); z.resize(n, 0);
         vx.resize(n, 0); vy.resize(n, 0); vz.resize(n, 0);
         ax.assign(n, 0); ay.assign(n, 0); az.assign(n, 0);
         m.resize(n, 0); type.resize(n, 0);
+        assignIds();
+        accValid = false;
     }
 
     void addParticle(real px, real py, real pz, real pvx, real pvy, real pvz, real pm, int ptype) {
@@ -39,6 +46,8 @@ struct Particle {
         ax.push_back(0); ay.push_back(0); az.push_back(0);
         m.push_back(pm);
         type.push_back(ptype);
+        id.push_back(0); // call assignIds() once the particles are added
+        accValid = false;
     }
 
     size_t size() const { return x.size(); }
@@ -47,7 +56,56 @@ struct Particle {
         x.clear(); y.clear(); z.clear();
         vx.clear(); vy.clear(); vz.clear();
         ax.clear(); ay.clear(); az.clear();
-        m.clear(); type.clear();
+        m.clear(); type.clear(); id.clear(); rung.clear(); cost.clear();
+        accValid = false;
+    }
+
+    /**
+     * @brief Gives an ID to every particle that does not have one yet (ID 0 means "none").
+     * New IDs continue after the largest existing one, so IDs read from a file never clash.
+     */
+    void assignIds() {
+        id.resize(size(), 0);
+        uint64_t next = 1;
+        for (uint64_t v : id) next = std::max(next, v + 1);
+        for (uint64_t& v : id) {
+            if (v == 0) v = next++;
+        }
+    }
+
+    /**
+     * @brief Calls f(lane) for every per-particle lane, whatever its element type.
+     * Code that moves particles around (reordering, migration between ranks) goes through
+     * this list, so a new lane only has to be added here.
+     */
+    template <typename F>
+    void forEachLane(F&& f) {
+        for (auto* lane : { &x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &m, &cost })
+            f(*lane);
+        f(type);
+        f(rung);
+        f(id);
+    }
+
+    /**
+     * @brief Reorders every lane so that the new particle k is the old particle order[k].
+     * Lanes that are not sized to the particle count (e.g. unused accelerations) are left alone.
+     */
+    void permute(const std::vector<int>& order) {
+        forEachLane([&](auto& lane) { permuteLane(lane, order); });
+    }
+
+private:
+    template <typename T>
+    static void permuteLane(std::vector<T>& lane, const std::vector<int>& order) {
+        const int n = static_cast<int>(order.size());
+        if (lane.size() != order.size()) return;
+
+        std::vector<T> scratch(n);
+        #pragma omp parallel for schedule(static)
+        for (int k = 0; k < n; ++k)
+            scratch[k] = lane[order[k]];
+        lane.swap(scratch);
     }
 };
 
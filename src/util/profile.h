@@ -0,0 +1,219 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#pragma once
+// Scoped phase timers and counters for finding out where a step spends its time.
+// Built in with -DNEXT_PROFILE (CMake option NEXT_PROFILE); otherwise every macro below
+// expands to nothing and its arguments are not evaluated.
+//
+//   NEXT_PROFILE_OPEN("profile", rank);              // start writing profile.json / profile.csv
+//   NEXT_PROFILE_SCOPE("tree.build");                 // times the enclosing block
+//   NEXT_PROFILE_COUNTER("tree.nodes", tree.nodes.size());
+//   NEXT_PROFILE_END_STEP(step);                      // flush, once per main-loop iteration
+//
+// Names must be string literals (only the pointer is stored).
+
+#ifdef NEXT_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Collects the timers and counters of all threads and writes them out once per step:
+ * every event to a Chrome/Perfetto trace (<base>.json, JSON array format, one process per rank
+ * and one track per thread), and the per-step sums to <base>.csv.
+ * Each thread appends to its own buffer, so recording never takes a lock. endStep() drains the
+ * buffers and must be called outside parallel regions. Nothing is recorded before open().
+ */
+class Profiler {
+public:
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    void open(const std::string& base, int rank) {
+        close();
+        pid = rank;
+        trace.open(base + ".json");
+        csv.open(base + ".csv");
+        csv << "step,rank,kind,name,count,total,max\n";
+        trace << "[\n";
+        first = true;
+        writeEvent("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}", pid, pid);
+        on = static_cast<bool>(trace) && static_cast<bool>(csv);
+    }
+
+    bool enabled() const { return on; }
+
+    /** @brief Microseconds since the profiler was created. */
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void record(const char* name, double t0, double t1) {
+        buffer().events.push_back(Event{ name, t0, t1 - t0, false });
+    }
+
+    void counter(const char* name, double value) {
+        if (on) buffer().events.push_back(Event{ name, now(), value, true });
+    }
+
+    /**
+     * @brief Writes out and clears everything recorded since the last call.
+     * CSV rows: timers give the call count, total and longest call in ms (summed over threads);
+     * counters give the sample count, sum and maximum of their values.
+     */
+    void endStep(long long step) {
+        if (!on) return;
+
+        std::map<std::pair<bool, std::string>, Sum> sums;
+        for (auto& buf : buffers) {
+            if (!buf->named) {
+                writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                           pid, buf->tid, buf->tid);
+                buf->named = true;
+            }
+            for (const Event& e : buf->events) {
+                if (e.counter) {
+                    writeEvent("{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"value\":%.9g}}",
+                               e.name, e.ts, pid, e.value);
+                } else {
+                    writeEvent("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                               e.name, e.ts, e.value, pid, buf->tid);
+                }
+                Sum& s = sums[{ e.counter, e.name }];
+                const double v = e.counter ? e.value : e.value * 1e-3;
+                s.count++;
+                s.total += v;
+                s.max = (s.count == 1) ? v : std::max(s.max, v);
+            }
+            buf->events.clear();
+        }
+
+        for (const auto& kv : sums) {
+            char line[512];
+            std::snprintf(line, sizeof(line), "%lld,%d,%s,%s,%lld,%.6g,%.6g\n", step, pid,
+                          kv.first.first ? "counter" : "timer", kv.first.second.c_str(),
+                          kv.second.count, kv.second.total, kv.second.max);
+            csv << line;
+        }
+        trace.flush();
+        csv.flush();
+    }
+
+    /** @brief Terminates the trace and closes both files. */
+    void close() {
+        if (!on) return;
+        on = false;
+        trace << "\n]\n";
+        trace.close();
+        csv.close();
+    }
+
+    ~Profiler() { close(); }
+
+private:
+    struct Event {
+        const char* name;
+        double ts;          // Start, us
+        double value;       // Duration in us for timers, the sample for counters
+        bool counter;
+    };
+
+    struct ThreadBuffer {
+        int tid = 0;
+        bool named = false;
+        std::vector<Event> events;
+    };
+
+    struct Sum {
+        long long count = 0;
+        double total = 0, max = 0;
+    };
+
+    Profiler() : epoch(std::chrono::steady_clock::now()) {}
+
+    ThreadBuffer& buffer() {
+        thread_local ThreadBuffer* local = nullptr;
+        if (!local) {
+            std::lock_guard<std::mutex> lock(registry);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            local = buffers.back().get();
+            local->tid = static_cast<int>(buffers.size()) - 1;
+            local->events.reserve(1024);
+        }
+        return *local;
+    }
+
+    template <typename... Args>
+    void writeEvent(const char* fmt, Args... args) {
+        char line[512];
+        std::snprintf(line, sizeof(line), fmt, args...);
+        trace << (first ? "" : ",\n") << line;
+        first = false;
+    }
+
+    std::chrono::steady_clock::time_point epoch;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::mutex registry;
+    std::ofstream trace, csv;
+    int pid = 0;
+    bool on = false;
+    bool first = true;
+};
+
+/**
+ * @brief Records the time between its construction and destruction under 'name'.
+ */
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name)
+        : name(name), t0(Profiler::instance().enabled() ? Profiler::instance().now() : -1.0) {}
+
+    ~ProfileScope() {
+        if (t0 >= 0) Profiler::instance().record(name, t0, Profiler::instance().now());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name;
+    double t0;
+};
+
+#define NEXT_PROFILE_CONCAT_(a, b) a##b
+#define NEXT_PROFILE_CONCAT(a, b) NEXT_PROFILE_CONCAT_(a, b)
+#define NEXT_PROFILE_SCOPE(name) ProfileScope NEXT_PROFILE_CONCAT(nextProfileScope_, __LINE__)(name)
+#define NEXT_PROFILE_COUNTER(name, value) Profiler::instance().counter(name, static_cast<double>(value))
+
+#define NEXT_PROFILE_OPEN(base, rank) Profiler::instance().open(base, rank)
+#define NEXT_PROFILE_END_STEP(step) Profiler::instance().endStep(step)
+#define NEXT_PROFILE_CLOSE() Profiler::instance().close()
+
+#else
+
+#define NEXT_PROFILE_SCOPE(name) do {} while (0)
+#define NEXT_PROFILE_COUNTER(name, value) do {} while (0)
+#define NEXT_PROFILE_OPEN(base, rank) do {} while (0)
+#define NEXT_PROFILE_END_STEP(step) do {} while (0)
+#define NEXT_PROFILE_CLOSE() do {} while (0)
+
+#endif
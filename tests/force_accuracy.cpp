@@ -0,0 +1,100 @@
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// force_accuracy: the Barnes-Hut walks and the FMM against DirectSum::reference() on small
+// initial conditions. Exits non-zero if a solver is off by more than its tolerance.
+
+#include "ics.h"
+#include "floatdef.h"
+#include "gravity/direct.h"
+#include "gravity/step.h"
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+namespace {
+
+constexpr int kParticles = 2000;
+constexpr uint64_t kSeed = 12345;
+
+/** @brief RMS relative error of the accelerations in ps against the reference (ax, ay, az). */
+double rmsError(const ParticleSystem& ps, const std::vector<real>& ax, const std::vector<real>& ay,
+                const std::vector<real>& az) {
+    double sum = 0;
+    for (size_t i = 0; i < ps.size(); ++i) {
+        const double dx = ps.ax[i] - ax[i], dy = ps.ay[i] - ay[i], dz = ps.az[i] - az[i];
+        const double a2 = double(ax[i]) * ax[i] + double(ay[i]) * ay[i] + double(az[i]) * az[i];
+        if (a2 > 0) sum += (dx * dx + dy * dy + dz * dz) / a2;
+    }
+    return ps.size() ? std::sqrt(sum / ps.size()) : 0.0;
+}
+
+/**
+ * @brief Checks every solver on one set of initial conditions; false if any is out of tolerance.
+ */
+bool checkIc(const char* name, const Particle& ic) {
+    stepState() = StepState();
+    ParticleSystem ps = ic;
+    const int N = static_cast<int>(ps.size());
+    reorderParticles(ps);
+    Octree tree;
+    buildTree(tree, ps);
+
+    GravityConfig cfg;
+    cfg.directBelow = 0;
+
+    // The reference softens each source like its leaf, so it needs the tree the solvers walk
+    computeForces(ps, tree, cfg, 0, N);
+    std::vector<int> targets(N);
+    std::iota(targets.begin(), targets.end(), 0);
+    std::vector<real> ax, ay, az;
+    DirectSum direct;
+    direct.reference(tree, ps, N, targets, ax, ay, az);
+
+    // A walk that opens every node sums the same pairs as the reference, up to rounding
+    const double exact = sizeof(treal) == 8 ? 1e-9 : 1e-4;
+
+    struct Case { const char* solver; real theta; TreeWalk walk; GravitySolver kind; double tolerance; };
+    const Case cases[] = {
+        { "particle", real(0.5),  TreeWalk::Particle, GravitySolver::BarnesHut, 0.1 },
+        { "group",    real(0.5),  TreeWalk::Group,    GravitySolver::BarnesHut, 0.1 },
+        { "fmm",      real(0.5),  TreeWalk::Particle, GravitySolver::Fmm,       0.1 },
+        { "particle", real(0.25), TreeWalk::Particle, GravitySolver::BarnesHut, 0.03 },
+        { "fmm",      real(0.25), TreeWalk::Particle, GravitySolver::Fmm,       0.03 },
+        { "particle", real(0),    TreeWalk::Particle, GravitySolver::BarnesHut, exact },
+    };
+
+    bool ok = true;
+    for (const Case& c : cases) {
+        GravityConfig run = cfg;
+        run.theta = c.theta;
+        run.walk = c.walk;
+        run.solver = c.kind;
+        computeForces(ps, tree, run, 0, N);
+        const double error = rmsError(ps, ax, ay, az);
+        const bool pass = error <= c.tolerance;
+        std::printf("%-8s %-8s theta=%.2f rms_error=%.3e tolerance=%.0e %s\n", name, c.solver,
+                    double(c.theta), error, c.tolerance, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    IcRandom plummer(kSeed), cube(kSeed), merger(kSeed);
+    bool ok = checkIc("plummer", icPlummer(kParticles, plummer));
+    ok = checkIc("cube", icUniformCube(kParticles, cube)) && ok;
+    ok = checkIc("merger", icMerger(kParticles, merger)) && ok;
+    return ok ? 0 : 1;
+}